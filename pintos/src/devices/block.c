@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#ifdef FILESYS
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#endif
 
 /* A block device. */
 struct block
@@ -139,6 +143,68 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   block->write_cnt++;
 }
 
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that can do so transfer all of them with a
+   single request; for others this is the same as calling
+   block_read() for each sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        block->ops->read (block->aux, sector + i,
+                          buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.  Drivers that can do so transfer all of them with
+   a single request; for others this is the same as calling
+   block_write() for each sector.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else
+    {
+      size_t i;
+
+      for (i = 0; i < cnt; i++)
+        block->ops->write (block->aux, sector + i,
+                           buffer + i * BLOCK_SECTOR_SIZE);
+    }
+  block->write_cnt += cnt;
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
@@ -176,6 +242,11 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+  ide_print_stats ();
+#ifdef FILESYS
+  cache_print_stats ();
+  dcache_print_stats ();
+#endif
 }
 
 /* Registers a new block device with the given NAME.  If
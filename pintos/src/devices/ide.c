@@ -5,13 +5,26 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  If the
+   controller is a PCI bus master, as is the PIIX that QEMU
+   emulates, it moves data by DMA; otherwise, it uses PIO.
+
+   Callers do not drive the controller themselves.  Each request
+   goes into its channel's queue, and the caller sleeps until it
+   is done.  A dispatcher thread for each channel takes requests
+   from the queue in elevator order, merges requests for adjacent
+   sectors into a single command, and carries them out, so the
+   two channels work independently. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +43,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master port addresses.  The channel's bus master base is
+   that of the controller plus 8 for the second channel. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus Master Command Register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_TO_MEMORY 0x08      /* Transfer from disk to memory. */
+
+/* Bus Master Status Register bits. */
+#define BMS_ERR 0x02            /* Error, write 1 to clear. */
+#define BMS_INTR 0x04           /* Interrupt, write 1 to clear. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +77,21 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Maximum number of sectors transferred by a single READ or
+   WRITE command.  A sector count of 0 in the command means this
+   many. */
+#define MAX_CMD_SECTORS 256
+
+/* A request that has waited this many timer ticks in a queue is
+   carried out next, whatever its place in elevator order, so
+   that requests far from the others are not starved. */
+#define REQUEST_DEADLINE (TIMER_FREQ / 2)
 
 /* An ATA device. */
 struct ata_disk
@@ -57,38 +100,117 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt with READ and
+                                   WRITE MULTIPLE, or 0 to use READ and
+                                   WRITE SECTOR. */
+    bool dma;                   /* Transfer data by DMA? */
   };
 
+/* A physical region descriptor, which tells the bus master where
+   in memory to transfer data.  A table of them describes all of
+   the memory for one command.  No region may cross a 64 kB
+   boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, which must be even. */
+    uint16_t size;              /* Size in bytes, with 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last descriptor. */
+  };
+
+/* Marks the last descriptor in a PRD table. */
+#define PRD_EOT 0x8000
+
+/* Number of descriptors in a PRD table, which takes a page. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
 /* An ATA channel (aka controller).
-   Each channel can control up to two disks. */
+   Each channel can control up to two disks, but it carries out
+   only one command at a time, so requests for both disks share
+   the channel's queue. */
 struct channel
   {
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base I/O port, or 0 if the
+                                   channel cannot do DMA. */
+    struct prd *prdt;           /* PRD table, if bm_base is nonzero. */
+
+    struct lock lock;           /* Protects the queue and statistics. */
+    struct list queue;          /* Waiting ide_requests, oldest first. */
+    size_t queue_len;           /* Number of requests in queue. */
+    struct condition queue_cond;        /* Signaled when queue grows. */
+    uint32_t head;              /* Sort key just past the last command. */
+
+    unsigned long long request_cnt;     /* Requests submitted. */
+    unsigned long long command_cnt;     /* Commands issued for them. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+    unsigned long long expire_cnt;      /* Requests run by deadline. */
+    size_t max_queue_len;       /* Longest the queue has been. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
+/* A request to read or write consecutive sectors of a disk. */
+struct ide_request
+  {
+    struct list_elem elem;      /* Element in queue or command. */
+    struct ata_disk *disk;      /* Disk to access. */
+    block_sector_t sec_no;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    uint8_t *buffer;            /* CNT * BLOCK_SECTOR_SIZE bytes of data. */
+    bool is_write;              /* Write to disk, or read from it? */
+    int64_t deadline;           /* Timer tick by which to start. */
+    struct semaphore done;      /* Up'd when the request is complete. */
+  };
+
+/* One or more requests for adjacent sectors of a disk, in sector
+   order, carried out with a single command. */
+struct command
+  {
+    struct ata_disk *disk;      /* Disk to access. */
+    block_sector_t sec_no;      /* First sector. */
+    size_t cnt;                 /* Total number of sectors. */
+    bool is_write;              /* Write to disk, or read from it? */
+    struct list requests;       /* The ide_requests. */
+  };
+
 /* We support the two "legacy" ATA channels found in a standard PC. */
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
+static void ide_read_multiple (void *, block_sector_t, size_t cnt, void *);
+static void ide_write_multiple (void *, block_sector_t, size_t cnt,
+                                const void *);
+
+static void submit_request (struct ata_disk *, block_sector_t, size_t cnt,
+                            void *buffer, bool is_write);
+static void dispatcher (void *channel);
+static struct ide_request *pick_request (struct channel *);
+static void merge_requests (struct channel *, struct command *);
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int multiple);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static void pio_read (struct command *);
+static void pio_write (struct command *);
+
+static bool can_dma (struct command *);
+static void build_prdt (struct channel *, struct command *);
+static void dma_transfer (struct command *);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +223,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,9 +246,28 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      lock_init (&c->lock);
+      list_init (&c->queue);
+      c->queue_len = 0;
+      cond_init (&c->queue_cond);
+      c->head = 0;
+      c->request_cnt = c->command_cnt = 0;
+      c->merge_cnt = c->expire_cnt = 0;
+      c->max_queue_len = 0;
+
+      /* Prepare for DMA, if the controller can do it. */
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = NULL;
+      if (c->bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            outb (reg_bm_command (c), 0);
+          else
+            c->bm_base = 0;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +278,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -144,6 +288,12 @@ ide_init (void)
       /* Reset hardware. */
       reset_channel (c);
 
+      /* Start the dispatcher, which partition scanning needs.
+         Until ide_init() returns, only this thread submits
+         requests, and it does so only between the commands that
+         it issues itself to identify disks. */
+      thread_create (c->name, PRI_MAX, dispatcher, c);
+
       /* Distinguish ATA hard disks from other devices. */
       if (check_device_type (&c->devices[0]))
         check_device_type (&c->devices[1]);
@@ -159,6 +309,43 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* Looks for a PCI IDE controller that can act as a bus master
+   and that drives both channels at the legacy ports, as the PIIX
+   does in compatibility mode.  If there is one, enables it as a
+   bus master and returns its bus master base I/O port;
+   otherwise, returns 0. */
+static uint16_t
+find_bus_master (void) 
+{
+  struct pci_addr addr;
+  uint8_t prog_if;
+  uint32_t bar, command;
+
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &addr))
+    return 0;
+
+  /* Programming interface bit 7 means the controller can be a bus
+     master.  Bits 0 and 2 mean that the primary and secondary
+     channels, respectively, are at ports of their own choosing
+     instead of the legacy ones that we use. */
+  prog_if = pci_read_config (addr, PCI_REG_CLASS) >> 8;
+  if ((prog_if & 0x80) == 0 || (prog_if & 0x05) != 0)
+    return 0;
+
+  /* BAR 4 holds the bus master base, which must be in I/O
+     space. */
+  bar = pci_read_config (addr, PCI_REG_BAR (4));
+  if ((bar & 1) == 0 || (bar & 0xfffc) == 0)
+    return 0;
+
+  /* Write back only the command half of the register, because
+     writing 1-bits to the status half clears them. */
+  command = pci_read_config (addr, PCI_REG_COMMAND) & 0xffff;
+  pci_write_config (addr, PCI_REG_COMMAND,
+                    command | PCI_CMD_IO | PCI_CMD_MASTER);
+  return bar & 0xfffc;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -272,7 +459,7 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
@@ -303,12 +490,44 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Transfer as many sectors per interrupt as the disk allows.
+     Word 47 gives the most sectors per DRQ block that READ and
+     WRITE MULTIPLE support, or 0 if they are not supported. */
+  if (id[47 * 2] != 0)
+    set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
+  /* Use DMA if the channel can do it and word 49 says the disk
+     can too. */
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x0100) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Sends a SET MULTIPLE MODE command to disk D to make READ and
+   WRITE MULTIPLE transfer MULTIPLE sectors per DRQ block, and
+   records the setting in D if the disk accepts it. */
+static void
+set_multiple_mode (struct ata_disk *d, int multiple) 
+{
+  struct channel *c = d->channel;
+
+  ASSERT (multiple > 0 && multiple < MAX_CMD_SECTORS);
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = multiple;
+  else
+    printf ("%s: SET MULTIPLE MODE to %d sectors failed\n",
+            d->name, multiple);
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -344,16 +563,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d_, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -364,36 +574,78 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Submits one request for each MAX_CMD_SECTORS sectors, instead
+   of one per sector.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      size_t sec_cnt = cnt < MAX_CMD_SECTORS ? cnt : MAX_CMD_SECTORS;
+
+      submit_request (d_, sec_no, sec_cnt, buffer, false);
+      sec_no += sec_cnt;
+      buffer += sec_cnt * BLOCK_SECTOR_SIZE;
+      cnt -= sec_cnt;
+    }
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Submits one
+   request for each MAX_CMD_SECTORS sectors, instead of one per
+   sector.  Returns after the disk has acknowledged receiving the
+   data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer_)
+{
+  uint8_t *buffer = (uint8_t *) buffer_;
+
+  while (cnt > 0)
+    {
+      size_t sec_cnt = cnt < MAX_CMD_SECTORS ? cnt : MAX_CMD_SECTORS;
+
+      submit_request (d_, sec_no, sec_cnt, buffer, true);
+      sec_no += sec_cnt;
+      buffer += sec_cnt * BLOCK_SECTOR_SIZE;
+      cnt -= sec_cnt;
+    }
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO to the disk's sector selection registers and CNT,
+   which must be between 1 and MAX_CMD_SECTORS, to its sector
+   count register.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_CMD_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_CMD_SECTORS);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,7 +656,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
@@ -430,6 +682,361 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Request queue. */
+
+/* Returns the key by which the elevator orders request R: by
+   disk, then by sector. */
+static uint32_t
+request_key (const struct ide_request *r) 
+{
+  return ((uint32_t) r->disk->dev_no << 28) | r->sec_no;
+}
+
+/* Asks disk D's dispatcher to transfer CNT sectors, at most
+   MAX_CMD_SECTORS, starting at SEC_NO between the disk and
+   BUFFER: to the disk if IS_WRITE is true, from it otherwise.
+   Sleeps until the transfer is done. */
+static void
+submit_request (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+                void *buffer, bool is_write) 
+{
+  struct channel *c = d->channel;
+  struct ide_request r;
+
+  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_CMD_SECTORS);
+
+  r.disk = d;
+  r.sec_no = sec_no;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.is_write = is_write;
+  r.deadline = timer_ticks () + REQUEST_DEADLINE;
+  sema_init (&r.done, 0);
+
+  lock_acquire (&c->lock);
+  list_push_back (&c->queue, &r.elem);
+  if (++c->queue_len > c->max_queue_len)
+    c->max_queue_len = c->queue_len;
+  c->request_cnt++;
+  cond_signal (&c->queue_cond, &c->lock);
+  lock_release (&c->lock);
+
+  sema_down (&r.done);
+}
+
+/* Dispatcher thread for the channel passed as CHANNEL_.  Takes
+   requests from the channel's queue one at a time, merges into
+   each one the queued requests for the sectors just before and
+   after it, and carries them out with a single command, so that
+   the channel is kept busy as long as there are requests. */
+static void
+dispatcher (void *channel_) 
+{
+  struct channel *c = channel_;
+
+  for (;;)
+    {
+      struct command cmd;
+      struct ide_request *r;
+
+      lock_acquire (&c->lock);
+      while (list_empty (&c->queue))
+        cond_wait (&c->queue_cond, &c->lock);
+      r = pick_request (c);
+      list_remove (&r->elem);
+      c->queue_len--;
+
+      cmd.disk = r->disk;
+      cmd.sec_no = r->sec_no;
+      cmd.cnt = r->cnt;
+      cmd.is_write = r->is_write;
+      list_init (&cmd.requests);
+      list_push_back (&cmd.requests, &r->elem);
+      merge_requests (c, &cmd);
+      c->command_cnt++;
+      lock_release (&c->lock);
+
+      if (can_dma (&cmd))
+        dma_transfer (&cmd);
+      else if (cmd.is_write)
+        pio_write (&cmd);
+      else
+        pio_read (&cmd);
+      c->head = ((uint32_t) cmd.disk->dev_no << 28) | (cmd.sec_no + cmd.cnt);
+
+      /* Wake the requesters.  Each request belongs to its
+         requester, so it may vanish as soon as it is up'd. */
+      while (!list_empty (&cmd.requests))
+        {
+          struct list_elem *e = list_pop_front (&cmd.requests);
+          sema_up (&list_entry (e, struct ide_request, elem)->done);
+        }
+    }
+}
+
+/* Chooses the next request to carry out from channel C's queue,
+   which must not be empty, in C-LOOK order: the request with the
+   lowest sector at or after the end of the last command, or if
+   there is none, the lowest sector of all.  But if the oldest
+   request's deadline has passed, chooses it instead. */
+static struct ide_request *
+pick_request (struct channel *c) 
+{
+  struct ide_request *oldest, *next, *lowest;
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (!list_empty (&c->queue));
+
+  oldest = list_entry (list_front (&c->queue), struct ide_request, elem);
+  if (timer_ticks () >= oldest->deadline)
+    {
+      c->expire_cnt++;
+      return oldest;
+    }
+
+  next = lowest = NULL;
+  for (e = list_begin (&c->queue); e != list_end (&c->queue);
+       e = list_next (e))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+      uint32_t key = request_key (r);
+
+      if (lowest == NULL || key < request_key (lowest))
+        lowest = r;
+      if (key >= c->head && (next == NULL || key < request_key (next)))
+        next = r;
+    }
+  return next != NULL ? next : lowest;
+}
+
+/* Moves requests from channel C's queue into CMD as long as
+   there is one, in the same direction, for the sectors just
+   before or just after CMD's on the same disk, and CMD stays
+   within MAX_CMD_SECTORS. */
+static void
+merge_requests (struct channel *c, struct command *cmd) 
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  e = list_begin (&c->queue);
+  while (e != list_end (&c->queue))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+
+      if (r->disk != cmd->disk || r->is_write != cmd->is_write
+          || cmd->cnt + r->cnt > MAX_CMD_SECTORS)
+        e = list_next (e);
+      else if (r->sec_no == cmd->sec_no + cmd->cnt
+               || r->sec_no + r->cnt == cmd->sec_no)
+        {
+          list_remove (e);
+          c->queue_len--;
+          c->merge_cnt++;
+          if (r->sec_no < cmd->sec_no)
+            {
+              list_push_front (&cmd->requests, &r->elem);
+              cmd->sec_no = r->sec_no;
+            }
+          else
+            list_push_back (&cmd->requests, &r->elem);
+          cmd->cnt += r->cnt;
+
+          /* CMD grew, so requests already passed over may be
+             adjacent to it now. */
+          e = list_begin (&c->queue);
+        }
+      else
+        e = list_next (e);
+    }
+}
+
+/* Prints request queue statistics for each channel. */
+void
+ide_print_stats (void) 
+{
+  struct channel *c;
+
+  for (c = channels; c < channels + CHANNEL_CNT; c++)
+    if (c->request_cnt > 0)
+      printf ("%s: %llu requests, %llu commands, %llu merged, "
+              "%llu past deadline, max queue depth %zu\n",
+              c->name, c->request_cnt, c->command_cnt, c->merge_cnt,
+              c->expire_cnt, c->max_queue_len);
+}
+
+/* PIO transfers. */
+
+/* Reads the sectors for CMD from its disk into its requests'
+   buffers in PIO mode.  The disk interrupts as each DRQ block,
+   of D->multiple sectors with READ MULTIPLE or of one sector
+   with READ SECTOR, becomes ready to be read. */
+static void
+pio_read (struct command *cmd) 
+{
+  struct ata_disk *d = cmd->disk;
+  struct channel *c = d->channel;
+  size_t drq_sectors = d->multiple > 0 ? d->multiple : 1;
+  size_t i = 0;
+  struct list_elem *e;
+
+  select_sector (d, cmd->sec_no, cmd->cnt);
+  issue_command (c, (d->multiple > 0
+                     ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY));
+  for (e = list_begin (&cmd->requests); e != list_end (&cmd->requests);
+       e = list_next (e))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+      size_t j;
+
+      for (j = 0; j < r->cnt; i++, j++)
+        {
+          if (i % drq_sectors == 0)
+            {
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, cmd->sec_no + i);
+            }
+          input_sector (c, r->buffer + j * BLOCK_SECTOR_SIZE);
+        }
+    }
+}
+
+/* Writes the sectors for CMD to its disk from its requests'
+   buffers in PIO mode.  The disk interrupts as it becomes ready
+   for each DRQ block after the first, of D->multiple sectors
+   with WRITE MULTIPLE or of one sector with WRITE SECTOR, and
+   once more when it has received the last. */
+static void
+pio_write (struct command *cmd) 
+{
+  struct ata_disk *d = cmd->disk;
+  struct channel *c = d->channel;
+  size_t drq_sectors = d->multiple > 0 ? d->multiple : 1;
+  size_t i = 0;
+  struct list_elem *e;
+
+  select_sector (d, cmd->sec_no, cmd->cnt);
+  issue_command (c, (d->multiple > 0
+                     ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY));
+  for (e = list_begin (&cmd->requests); e != list_end (&cmd->requests);
+       e = list_next (e))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+      size_t j;
+
+      for (j = 0; j < r->cnt; i++, j++)
+        {
+          if (i % drq_sectors == 0)
+            {
+              if (i > 0)
+                sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, cmd->sec_no + i);
+            }
+          output_sector (c, r->buffer + j * BLOCK_SECTOR_SIZE);
+        }
+    }
+  sema_down (&c->completion_wait);
+}
+
+/* Bus master DMA. */
+
+/* Returns true if CMD's data can move by DMA.  Its disk must
+   support DMA, and the bus master must be able to find each
+   request's buffer by its physical address, so it must be in
+   kernel memory, which is physically contiguous, and at an even
+   address. */
+static bool
+can_dma (struct command *cmd) 
+{
+  struct list_elem *e;
+
+  if (!cmd->disk->dma)
+    return false;
+  for (e = list_begin (&cmd->requests); e != list_end (&cmd->requests);
+       e = list_next (e))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+      if (!is_kernel_vaddr (r->buffer) || ((uintptr_t) r->buffer & 1) != 0)
+        return false;
+    }
+  return true;
+}
+
+/* Fills in channel C's PRD table to describe the buffers of
+   CMD's requests, in order, splitting them at 64 kB physical
+   boundaries. */
+static void
+build_prdt (struct channel *c, struct command *cmd) 
+{
+  struct prd *prd = c->prdt;
+  struct list_elem *e;
+
+  for (e = list_begin (&cmd->requests); e != list_end (&cmd->requests);
+       e = list_next (e))
+    {
+      struct ide_request *r = list_entry (e, struct ide_request, elem);
+      uintptr_t addr = vtop (r->buffer);
+      size_t size = r->cnt * BLOCK_SECTOR_SIZE;
+
+      while (size > 0)
+        {
+          size_t boundary = 0x10000 - (addr & 0xffff);
+          size_t chunk = size < boundary ? size : boundary;
+
+          ASSERT (prd < c->prdt + PRD_CNT);
+          prd->addr = addr;
+          prd->size = chunk & 0xffff;
+          prd->flags = 0;
+          prd++;
+          addr += chunk;
+          size -= chunk;
+        }
+    }
+  ASSERT (prd > c->prdt);
+  prd[-1].flags = PRD_EOT;
+}
+
+/* Transfers the sectors for CMD between its disk and its
+   requests' buffers by DMA.  Sleeps until the disk interrupts to
+   signal that the whole transfer is done, so that the CPU is free
+   to run other threads meanwhile. */
+static void
+dma_transfer (struct command *cmd) 
+{
+  struct ata_disk *d = cmd->disk;
+  struct channel *c = d->channel;
+  uint8_t direction = cmd->is_write ? 0 : BMC_TO_MEMORY;
+  uint8_t bm_status;
+
+  /* Point the bus master at the buffers. */
+  build_prdt (c, cmd);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), BMS_ERR | BMS_INTR);
+  outb (reg_bm_command (c), direction);
+
+  /* Issue the command, then start the bus master. */
+  select_sector (d, cmd->sec_no, cmd->cnt);
+  issue_command (c, cmd->is_write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BMC_START);
+  sema_down (&c->completion_wait);
+
+  /* Stop the bus master and check for errors. */
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BMS_ERR | BMS_INTR);
+  wait_while_busy (d);
+  if ((bm_status & BMS_ERR) != 0 || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, cmd->is_write ? "write" : "read", cmd->sec_no);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
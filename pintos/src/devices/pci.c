@@ -0,0 +1,95 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* The code in this file accesses PCI configuration space with
+   configuration mechanism #1, which every PC chipset since the
+   first PCI ones supports. */
+
+/* Configuration mechanism #1 I/O ports. */
+#define PCI_CONFIG_ADDR 0xcf8   /* Selects a register. */
+#define PCI_CONFIG_DATA 0xcfc   /* Reads or writes the register. */
+
+/* Configuration address register bits. */
+#define PCI_ADDR_ENABLE 0x80000000
+
+/* Header type register bits. */
+#define PCI_HEADER_MULTI 0x00800000     /* Device has functions 1...7. */
+
+static void select_register (struct pci_addr, uint8_t reg);
+
+/* Returns the 32-bit configuration register REG, which must be a
+   multiple of 4, of the PCI function at ADDR.  Reading any
+   register of a function that does not exist yields all 1-bits. */
+uint32_t
+pci_read_config (struct pci_addr addr, uint8_t reg) 
+{
+  select_register (addr, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit configuration register REG, which
+   must be a multiple of 4, of the PCI function at ADDR. */
+void
+pci_write_config (struct pci_addr addr, uint8_t reg, uint32_t value) 
+{
+  select_register (addr, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Searches every PCI bus for the first function whose class is
+   CLASS and whose subclass is SUBCLASS.  If one is found, stores
+   its location in *ADDRP and returns true; otherwise, returns
+   false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_addr *addrp) 
+{
+  struct pci_addr addr;
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          uint32_t class_reg;
+
+          addr.bus = bus;
+          addr.dev = dev;
+          addr.func = func;
+          if ((pci_read_config (addr, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No such function.  Without function 0 there is no
+                 device at all. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class_reg = pci_read_config (addr, PCI_REG_CLASS);
+          if ((class_reg >> 24) == class
+              && ((class_reg >> 16) & 0xff) == subclass)
+            {
+              *addrp = addr;
+              return true;
+            }
+
+          /* Only multi-function devices have functions 1...7. */
+          if (func == 0
+              && !(pci_read_config (addr, PCI_REG_HEADER)
+                   & PCI_HEADER_MULTI))
+            break;
+        }
+  return false;
+}
+
+/* Makes register REG of the function at ADDR the one accessed
+   through PCI_CONFIG_DATA. */
+static void
+select_register (struct pci_addr addr, uint8_t reg) 
+{
+  ASSERT (addr.dev < 32 && addr.func < 8);
+  ASSERT (reg % 4 == 0);
+
+  outl (PCI_CONFIG_ADDR, (PCI_ADDR_ENABLE | (addr.bus << 16)
+                          | (addr.dev << 11) | (addr.func << 8) | reg));
+}
@@ -0,0 +1,35 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Location of a PCI function in configuration space. */
+struct pci_addr
+  {
+    uint8_t bus;                /* Bus number, 0...255. */
+    uint8_t dev;                /* Device number, 0...31. */
+    uint8_t func;               /* Function number, 0...7. */
+  };
+
+/* Configuration space registers.  Each is 32 bits wide and must
+   be accessed as a whole. */
+#define PCI_REG_ID 0x00         /* Device ID (high), vendor ID (low). */
+#define PCI_REG_COMMAND 0x04    /* Status (high), command (low). */
+#define PCI_REG_CLASS 0x08      /* Class, subclass, prog. i/f, revision. */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 16...23. */
+#define PCI_REG_BAR(N) (0x10 + 4 * (N))  /* Base address register N. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* Allow acting as bus master. */
+
+/* Classes and subclasses. */
+#define PCI_CLASS_STORAGE 0x01  /* Mass storage controller. */
+#define PCI_SUBCLASS_IDE 0x01   /* IDE controller. */
+
+uint32_t pci_read_config (struct pci_addr, uint8_t reg);
+void pci_write_config (struct pci_addr, uint8_t reg, uint32_t value);
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_addr *);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,665 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache.
+
+   All file system access to fs_device goes through a cache of
+   CACHE_SIZE sectors.  Blocks are replaced by the clock
+   algorithm.  Writes only mark a block dirty; dirty blocks reach
+   the disk when they are evicted, when the flusher thread wakes
+   up every FLUSH_INTERVAL timer ticks, or at cache_flush() from
+   filesys_done().
+
+   cache_flush() writes each dirty block together with the dirty
+   blocks for the sectors next to it, up to FLUSH_RUN_MAX of
+   them, with a single multi-sector request, gathering their
+   contents in a page of its own.  Files given their sectors in
+   long runs, as delayed allocation does, are thus written back
+   in a few large requests instead of one per sector.
+
+   A single lock protects the cache, but it is not held across
+   disk I/O.  A block with I/O in progress is marked busy, and
+   anyone who needs it waits on cache_cond until the I/O
+   completes.  While a dirty block is being written back it keeps
+   its old sector number, so a reader of that sector waits for the
+   write instead of fetching stale data from disk.
+
+   Data is copied into and out of the cache with the lock held,
+   so the buffers passed in must be kernel memory.  A page fault
+   on a user buffer would page it in through the file system,
+   which needs the lock again.  System calls copy user data
+   through a kernel page instead.
+
+   Sectors that a sequential reader is expected to want next are
+   queued with cache_read_ahead() and fetched by the read-ahead
+   thread, so that the reader usually finds them already cached.
+   Requests that arrive while the queue is full are dropped.
+
+   The cache also holds "delayed" blocks for delayed allocation.
+   A delayed block belongs to an inode and is named by a block
+   number within the file instead of a sector, because no sector
+   has been chosen for it yet.  Delayed blocks are never evicted
+   or written back; the inode layer picks sectors for them in
+   large runs and hands them back with cache_assign(), after
+   which they are ordinary dirty blocks.  The flusher has this
+   done for every open inode before it writes behind, so that
+   data written to a file that stays open still reaches the disk
+   within FLUSH_INTERVAL.  At most
+   CACHE_DELAYED_MAX blocks may be delayed at once, so that the
+   rest of the cache stays available for everything else. */
+
+/* Number of sectors cached. */
+#define CACHE_SIZE 64
+
+/* Timer ticks between write-behind flushes. */
+#define FLUSH_INTERVAL (TIMER_FREQ * 5)
+
+/* Maximum number of sectors written back by one request. */
+#define FLUSH_RUN_MAX (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Maximum number of queued read-ahead requests. */
+#define RA_QUEUE_SIZE 32
+
+/* A cached sector. */
+struct cache_block
+  {
+    block_sector_t sector;              /* Sector, or block if delayed. */
+    struct inode *owner;                /* Owner if delayed, else null. */
+    bool in_use;                        /* Holds a sector at all? */
+    bool dirty;                         /* Modified since read? */
+    bool accessed;                      /* Used since clock passed? */
+    bool busy;                          /* I/O in progress? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_block cache[CACHE_SIZE];
+static struct lock cache_lock;          /* Protects the cache. */
+static struct condition cache_cond;     /* Signaled when I/O completes. */
+static size_t clock_hand;               /* Next eviction candidate. */
+static size_t delayed_cnt;              /* Number of delayed blocks. */
+
+/* Write-behind. */
+static struct semaphore flush_sema;     /* Up'd every FLUSH_INTERVAL. */
+static bool flusher_started;            /* Flusher thread running? */
+static struct lock flush_lock;          /* Serializes cache_flush(). */
+static uint8_t *flush_buffer;           /* FLUSH_RUN_MAX sectors. */
+
+/* Read-ahead queue, protected by cache_lock. */
+static block_sector_t ra_queue[RA_QUEUE_SIZE]; /* Circular queue. */
+static size_t ra_head;                  /* Index of first request. */
+static size_t ra_cnt;                   /* Number of requests. */
+static struct condition ra_cond;        /* Signaled when queue non-empty. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Lookups found in cache. */
+static long long miss_cnt;              /* Lookups read from disk. */
+static long long evict_cnt;             /* Blocks evicted. */
+static long long writeback_cnt;         /* Dirty blocks written. */
+static long long write_req_cnt;         /* Write-back requests. */
+static long long read_ahead_cnt;        /* Blocks read ahead. */
+static long long delayed_total;         /* Blocks created delayed. */
+static long long direct_cnt;            /* Sectors read around cache. */
+
+static struct cache_block *cache_get (block_sector_t, bool read);
+static struct cache_block *cache_lookup (block_sector_t);
+static struct cache_block *cache_lookup_delayed (struct inode *, uint32_t);
+static struct cache_block *cache_alloc (void);
+static struct cache_block *cache_evict (void);
+static void cache_writeback (struct cache_block *);
+static void cache_writeback_run (struct cache_block *);
+static struct cache_block *cache_lookup_dirty (block_sector_t);
+static thread_func flusher NO_RETURN;
+static thread_func read_ahead_daemon NO_RETURN;
+
+/* Initializes the buffer cache and starts its flusher and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  lock_init (&cache_lock);
+  lock_init (&flush_lock);
+  cond_init (&cache_cond);
+  cond_init (&ra_cond);
+  sema_init (&flush_sema, 0);
+  flush_buffer = palloc_get_page (PAL_ASSERT);
+  if (thread_create ("cache-flush", PRI_DEFAULT, flusher, NULL)
+      == TID_ERROR
+      || thread_create ("cache-ra", PRI_DEFAULT, read_ahead_daemon, NULL)
+         == TID_ERROR)
+    PANIC ("could not start buffer cache threads");
+  flusher_started = true;
+}
+
+/* Reads SIZE bytes starting at offset OFS within SECTOR into
+   BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  b = cache_get (sector, true);
+  memcpy (buffer, b->data + ofs, size);
+  lock_release (&cache_lock);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR into BUFFER.
+   Sectors that are cached are copied out of the cache; each run
+   of sectors that are not is read from disk straight into
+   BUFFER, with one multi-sector request, and not cached, so that
+   a large transfer neither passes through the cache nor pushes
+   other blocks out of it.  The caller must make sure that nobody
+   writes these sectors meanwhile, e.g. by holding their inode's
+   lock. */
+void
+cache_read_direct (block_sector_t sector, size_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      struct cache_block *b;
+      size_t run;
+
+      lock_acquire (&cache_lock);
+      while ((b = cache_lookup (sector)) != NULL && b->busy)
+        cond_wait (&cache_cond, &cache_lock);
+      if (b != NULL)
+        {
+          hit_cnt++;
+          b->accessed = true;
+          memcpy (buffer, b->data, BLOCK_SECTOR_SIZE);
+          lock_release (&cache_lock);
+          run = 1;
+        }
+      else
+        {
+          for (run = 1; run < cnt; run++)
+            if (cache_lookup (sector + run) != NULL)
+              break;
+          direct_cnt += run;
+          lock_release (&cache_lock);
+
+          block_read_multiple (fs_device, sector, run, buffer);
+        }
+      sector += run;
+      buffer += run * BLOCK_SECTOR_SIZE;
+      cnt -= run;
+    }
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR starting at offset
+   OFS.  A write that covers the whole sector does not read it
+   from disk first. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  b = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (b->data + ofs, buffer, size);
+  b->dirty = true;
+  lock_release (&cache_lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache,
+   unless it is already cached or queued. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  if (cache_lookup (sector) != NULL || ra_cnt >= RA_QUEUE_SIZE)
+    {
+      lock_release (&cache_lock);
+      return;
+    }
+  for (i = 0; i < ra_cnt; i++)
+    if (ra_queue[(ra_head + i) % RA_QUEUE_SIZE] == sector)
+      {
+        lock_release (&cache_lock);
+        return;
+      }
+  ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_SIZE] = sector;
+  cond_signal (&ra_cond, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Copies SIZE bytes starting at offset OFS within delayed block
+   BLOCK of INODE into BUFFER.  Returns true if successful, false
+   if INODE has no such delayed block. */
+bool
+cache_read_delayed (struct inode *inode, uint32_t block, void *buffer,
+                    int ofs, int size)
+{
+  struct cache_block *b;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  b = cache_lookup_delayed (inode, block);
+  if (b != NULL)
+    {
+      b->accessed = true;
+      memcpy (buffer, b->data + ofs, size);
+    }
+  lock_release (&cache_lock);
+  return b != NULL;
+}
+
+/* Writes SIZE bytes from BUFFER into delayed block BLOCK of
+   INODE, starting at offset OFS.  If INODE has no such delayed
+   block and CREATE is true, creates one, with the bytes not
+   written set to zero.  Returns true if successful, false if
+   the block does not exist and was not created, either because
+   CREATE is false or because CACHE_DELAYED_MAX blocks are already
+   delayed. */
+bool
+cache_write_delayed (struct inode *inode, uint32_t block,
+                     const void *buffer, int ofs, int size, bool create)
+{
+  struct cache_block *b;
+
+  ASSERT (inode != NULL);
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      b = cache_lookup_delayed (inode, block);
+      if (b != NULL || !create || delayed_cnt >= CACHE_DELAYED_MAX)
+        break;
+      b = cache_alloc ();
+      if (b != NULL)
+        {
+          b->sector = block;
+          b->owner = inode;
+          b->in_use = true;
+          b->dirty = true;
+          memset (b->data, 0, BLOCK_SECTOR_SIZE);
+          delayed_cnt++;
+          delayed_total++;
+          break;
+        }
+    }
+  if (b != NULL)
+    {
+      b->accessed = true;
+      memcpy (b->data + ofs, buffer, size);
+    }
+  lock_release (&cache_lock);
+  return b != NULL;
+}
+
+/* Stores into BLOCKS, in no particular order, the numbers of up
+   to MAX delayed blocks of INODE, and returns the number
+   stored. */
+size_t
+cache_delayed_blocks (struct inode *inode, uint32_t blocks[], size_t max)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE && cnt < max; i++)
+    if (cache[i].in_use && cache[i].owner == inode)
+      blocks[cnt++] = cache[i].sector;
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Turns delayed block BLOCK of INODE into an ordinary dirty
+   block for SECTOR, which must have just been allocated.  Any
+   stale copy of SECTOR left in the cache from before it was last
+   freed is dropped. */
+void
+cache_assign (struct inode *inode, uint32_t block, block_sector_t sector)
+{
+  struct cache_block *b, *stale;
+
+  lock_acquire (&cache_lock);
+  while ((stale = cache_lookup (sector)) != NULL)
+    {
+      if (stale->busy)
+        cond_wait (&cache_cond, &cache_lock);
+      else
+        stale->in_use = false;
+    }
+  b = cache_lookup_delayed (inode, block);
+  ASSERT (b != NULL);
+  b->sector = sector;
+  b->owner = NULL;
+  delayed_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Drops all of INODE's delayed blocks without writing them, and
+   returns the number dropped. */
+size_t
+cache_discard (struct inode *inode)
+{
+  size_t cnt = 0;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].owner == inode)
+      {
+        cache[i].in_use = false;
+        cache[i].owner = NULL;
+        delayed_cnt--;
+        cnt++;
+      }
+  lock_release (&cache_lock);
+  return cnt;
+}
+
+/* Writes every dirty block to disk, in runs of consecutive
+   sectors.  Delayed blocks are left alone, because they have
+   nowhere to go yet. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&flush_lock);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_block *b = &cache[i];
+      while (b->busy)
+        cond_wait (&cache_cond, &cache_lock);
+      if (b->in_use && b->dirty && b->owner == NULL)
+        cache_writeback_run (b);
+    }
+  lock_release (&cache_lock);
+  lock_release (&flush_lock);
+}
+
+/* Timer interrupt hook: wakes the flusher every FLUSH_INTERVAL
+   ticks. */
+void
+cache_tick (void)
+{
+  static int64_t tick_cnt;
+
+  if (flusher_started && ++tick_cnt % FLUSH_INTERVAL == 0)
+    sema_up (&flush_sema);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, %lld evictions, "
+          "%lld write-backs in %lld requests, %lld read ahead, "
+          "%lld delayed, %lld direct\n",
+          hit_cnt, miss_cnt, evict_cnt, writeback_cnt, write_req_cnt,
+          read_ahead_cnt, delayed_total, direct_cnt);
+}
+
+/* Returns the cache block for SECTOR, bringing it into the cache
+   if necessary.  If READ is false, the caller is about to
+   overwrite the whole sector, so a block not already cached is
+   not read from disk.  The cache lock must be held; the block
+   stays put until the caller releases it. */
+static struct cache_block *
+cache_get (block_sector_t sector, bool read)
+{
+  struct cache_block *b;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      b = cache_lookup (sector);
+      if (b != NULL)
+        {
+          if (b->busy)
+            {
+              cond_wait (&cache_cond, &cache_lock);
+              continue;
+            }
+          hit_cnt++;
+          b->accessed = true;
+          return b;
+        }
+
+      b = cache_alloc ();
+      if (b != NULL)
+        break;
+    }
+
+  miss_cnt++;
+  b->sector = sector;
+  b->owner = NULL;
+  b->in_use = true;
+  b->dirty = false;
+  b->accessed = true;
+  if (read)
+    {
+      b->busy = true;
+      lock_release (&cache_lock);
+      block_read (fs_device, sector, b->data);
+      lock_acquire (&cache_lock);
+      b->busy = false;
+      cond_broadcast (&cache_cond, &cache_lock);
+    }
+  return b;
+}
+
+/* Returns the block holding SECTOR, or a null pointer if it is
+   not cached. */
+static struct cache_block *
+cache_lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].owner == NULL
+        && cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Returns the block holding SECTOR if it is cached, dirty, and
+   not busy, otherwise a null pointer. */
+static struct cache_block *
+cache_lookup_dirty (block_sector_t sector)
+{
+  struct cache_block *b = cache_lookup (sector);
+
+  return b != NULL && b->dirty && !b->busy ? b : NULL;
+}
+
+/* Returns delayed block BLOCK of INODE, or a null pointer if it
+   is not cached. */
+static struct cache_block *
+cache_lookup_delayed (struct inode *inode, uint32_t block)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].in_use && cache[i].owner == inode
+        && cache[i].sector == block)
+      return &cache[i];
+  return NULL;
+}
+
+/* Frees up a block for reuse and returns it, with in_use still
+   set if it held a sector.  The cache lock must be held.  If the
+   lock had to be released to wait for I/O or to write back the
+   victim, returns a null pointer instead, because whatever the
+   caller was about to cache may have been cached meanwhile; the
+   caller should look again and retry. */
+static struct cache_block *
+cache_alloc (void)
+{
+  struct cache_block *b;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  b = cache_evict ();
+  if (b == NULL)
+    {
+      /* Every block has I/O in progress. */
+      cond_wait (&cache_cond, &cache_lock);
+      return NULL;
+    }
+  if (b->in_use && b->dirty)
+    {
+      cache_writeback (b);
+      return NULL;
+    }
+  if (b->in_use)
+    evict_cnt++;
+  return b;
+}
+
+/* Chooses a block to reuse, by the clock algorithm, and returns
+   it.  Returns a null pointer if all blocks are busy. */
+static struct cache_block *
+cache_evict (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_block *b = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (!b->in_use)
+        return b;
+      if (b->busy || b->owner != NULL)
+        continue;
+      if (b->accessed)
+        b->accessed = false;
+      else
+        return b;
+    }
+  return NULL;
+}
+
+/* Writes dirty block B to disk.  The cache lock must be held; it
+   is released during the write. */
+static void
+cache_writeback (struct cache_block *b)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  ASSERT (b->in_use && b->dirty && !b->busy);
+
+  b->busy = true;
+  lock_release (&cache_lock);
+  block_write (fs_device, b->sector, b->data);
+  lock_acquire (&cache_lock);
+  b->busy = false;
+  b->dirty = false;
+  writeback_cnt++;
+  write_req_cnt++;
+  cond_broadcast (&cache_cond, &cache_lock);
+}
+
+/* Writes dirty block B to disk along with the dirty blocks for
+   the sectors just before and after it, up to FLUSH_RUN_MAX
+   sectors in all, in a single request through flush_buffer.  The
+   cache lock and flush_lock must be held; the cache lock is
+   released during the write. */
+static void
+cache_writeback_run (struct cache_block *b)
+{
+  struct cache_block *run[FLUSH_RUN_MAX];
+  block_sector_t first = b->sector;
+  size_t cnt, i;
+
+  ASSERT (lock_held_by_current_thread (&flush_lock));
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+  ASSERT (b->in_use && b->dirty && !b->busy);
+
+  /* Find the run of dirty blocks around B. */
+  while (first > 0 && b->sector - first < FLUSH_RUN_MAX - 1
+         && cache_lookup_dirty (first - 1) != NULL)
+    first--;
+  for (cnt = 0; cnt < FLUSH_RUN_MAX; cnt++)
+    {
+      run[cnt] = cache_lookup_dirty (first + cnt);
+      if (run[cnt] == NULL)
+        break;
+    }
+  if (cnt == 1)
+    {
+      cache_writeback (b);
+      return;
+    }
+
+  for (i = 0; i < cnt; i++)
+    {
+      run[i]->busy = true;
+      memcpy (flush_buffer + i * BLOCK_SECTOR_SIZE, run[i]->data,
+              BLOCK_SECTOR_SIZE);
+    }
+  lock_release (&cache_lock);
+  block_write_multiple (fs_device, first, cnt, flush_buffer);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      run[i]->busy = false;
+      run[i]->dirty = false;
+    }
+  writeback_cnt += cnt;
+  write_req_cnt++;
+  cond_broadcast (&cache_cond, &cache_lock);
+}
+
+/* Flusher thread: every FLUSH_INTERVAL ticks, gives sectors to
+   delayed blocks, writes the free map's changed sectors into the
+   cache, then writes dirty blocks behind. */
+static void
+flusher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&flush_sema);
+      inode_flush ();
+      free_map_flush ();
+      cache_flush ();
+    }
+}
+
+/* Read-ahead thread: fetches queued sectors into the cache. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      block_sector_t sector;
+
+      while (ra_cnt == 0)
+        cond_wait (&ra_cond, &cache_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+      ra_cnt--;
+
+      if (cache_lookup (sector) == NULL)
+        {
+          cache_get (sector, true);
+          read_ahead_cnt++;
+        }
+    }
+}
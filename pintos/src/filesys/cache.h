@@ -0,0 +1,30 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+
+struct inode;
+
+/* Maximum number of delayed-allocation blocks in the cache. */
+#define CACHE_DELAYED_MAX 32
+
+void cache_init (void);
+void cache_read (block_sector_t, void *, int ofs, int size);
+void cache_read_direct (block_sector_t, size_t cnt, void *);
+void cache_write (block_sector_t, const void *, int ofs, int size);
+void cache_read_ahead (block_sector_t);
+bool cache_read_delayed (struct inode *, uint32_t block, void *,
+                         int ofs, int size);
+bool cache_write_delayed (struct inode *, uint32_t block, const void *,
+                          int ofs, int size, bool create);
+size_t cache_delayed_blocks (struct inode *, uint32_t blocks[], size_t max);
+void cache_assign (struct inode *, uint32_t block, block_sector_t);
+size_t cache_discard (struct inode *);
+void cache_flush (void);
+void cache_tick (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
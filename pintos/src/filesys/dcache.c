@@ -0,0 +1,196 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the results of recent directory lookups, keyed by
+   the directory's inode sector and the name looked up, so that
+   looking up the same name again does not read the directory.
+   A name that was not found is remembered too, as a "negative"
+   entry whose sector is DCACHE_ABSENT, so that repeated probes
+   for missing files are just as cheap.
+
+   The directory code keeps the cache up to date: adding or
+   removing a name overwrites its entry, and creating a
+   directory purges any entries left over from an old directory
+   whose inode used the same sector.  When the cache is full,
+   the least recently used entry is replaced. */
+
+/* Number of cached names. */
+#define DCACHE_SIZE 256
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dcache. */
+    struct list_elem lru_elem;          /* Element in lru or free list. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name within directory. */
+    block_sector_t sector;              /* Inode sector or DCACHE_ABSENT. */
+  };
+
+static struct dentry dentries[DCACHE_SIZE];
+static struct hash dcache;              /* Cached names. */
+static struct list lru;                 /* Cached names, most recent last. */
+static struct list free_list;           /* Unused dentries. */
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Lookups that found a file. */
+static long long absent_cnt;            /* Lookups that found nothing. */
+static long long miss_cnt;              /* Lookups not cached. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+static struct dentry *find (block_sector_t dir, const char *name);
+static void discard (struct dentry *);
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  size_t i;
+
+  if (!hash_init (&dcache, dentry_hash, dentry_less, NULL))
+    PANIC ("could not create directory entry cache");
+  list_init (&lru);
+  list_init (&free_list);
+  lock_init (&dcache_lock);
+  for (i = 0; i < DCACHE_SIZE; i++)
+    list_push_back (&free_list, &dentries[i].lru_elem);
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   Returns false if the result is not cached.  Otherwise,
+   returns true and sets *SECTORP to the sector of the inode
+   NAME refers to, or to DCACHE_ABSENT if NAME does not exist. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_back (&lru, &d->lru_elem);
+      *sectorp = d->sector;
+      if (d->sector != DCACHE_ABSENT)
+        hit_cnt++;
+      else
+        absent_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory whose inode is in sector
+   DIR refers to the inode in SECTOR or, if SECTOR is
+   DCACHE_ABSENT, does not exist. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      if (list_empty (&free_list))
+        discard (list_entry (list_front (&lru), struct dentry, lru_elem));
+      d = list_entry (list_pop_front (&free_list), struct dentry, lru_elem);
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache, &d->hash_elem);
+    }
+  else
+    list_remove (&d->lru_elem);
+  d->sector = sector;
+  list_push_back (&lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Discards every cached name in the directory whose inode is in
+   sector DIR. */
+void
+dcache_purge (block_sector_t dir)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru); e != list_end (&lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir == dir)
+        discard (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dcache: %lld hits, %lld negative hits, %lld misses\n",
+          hit_cnt, absent_cnt, miss_cnt);
+}
+
+/* Returns the cached entry for NAME in DIR, or a null pointer if
+   there is none. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Removes D from the cache and returns it to the free list. */
+static void
+discard (struct dentry *d)
+{
+  hash_delete (&dcache, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  list_push_back (&free_list, &d->lru_elem);
+}
+
+/* Returns a hash of dentry E's directory and name. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
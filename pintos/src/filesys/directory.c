@@ -1,7 +1,10 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -21,12 +24,128 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* Directory formats.
+
+   A linear directory is just an array of struct dir_entry, which
+   must be searched from the start for every lookup.  Directories
+   are no longer created in this format, but existing ones are
+   still read and updated.
+
+   A hashed directory begins with a struct dir_header sector.
+   The next sectors are buckets, each a struct dir_bucket.  A
+   name's entry goes in the bucket picked by the hash of the name
+   or, if that bucket is full, in the overflow buckets chained
+   from it.  Overflow buckets are allocated in order starting at
+   block OVERFLOW_BLOCK, which leaves room below it for
+   MAX_BUCKETS buckets.  Buckets that have never been written lie
+   past end of file or in holes, so they take no space and read
+   as empty.
+
+   The directory grows its buckets by linear hashing, so that a
+   lookup usually reads a single bucket however large the
+   directory gets.  Whenever a new entry would leave the buckets
+   more than MAX_LOAD percent full on average, or finds its chain
+   full, bucket SPLIT is split, before any overflow bucket is
+   chained: its entries are divided between it and a new bucket
+   BASE_CNT + SPLIT, by one more bit of their hash, and SPLIT
+   advances.  When every one of the BASE_CNT buckets has been
+   split, BASE_CNT doubles and SPLIT starts over at 0.  A name
+   hashes to bucket HASH % BASE_CNT, unless that bucket has
+   already been split, in which case HASH % (2 * BASE_CNT) picks
+   between it and its new partner.
+
+   Neither format stores entries for "." and "..".  A hashed
+   directory's header records its parent instead, and a linear
+   directory can only be an old root directory, which is its own
+   parent. */
+
+/* Identifies a hashed directory.  Read as the inode sector of a
+   linear directory's first entry, it is far past the end of any
+   disk. */
+#define DIR_MAGIC 0x48524944
+
+/* Minimum and maximum number of buckets in a hashed
+   directory. */
+#define MIN_BUCKETS 16
+#define MAX_BUCKETS 65536
+
+/* First overflow bucket's block. */
+#define OVERFLOW_BLOCK (1 + MAX_BUCKETS)
+
+/* Percentage of entries in use, averaged over all buckets, past
+   which a hashed directory splits a bucket. */
+#define MAX_LOAD 50
+
+/* Hashed directory header.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_header
+  {
+    uint32_t magic;                     /* DIR_MAGIC. */
+    uint32_t base_cnt;                  /* Buckets before this round. */
+    uint32_t split;                     /* Next bucket to split. */
+    uint32_t overflow_cnt;              /* Overflow buckets. */
+    uint32_t entry_cnt;                 /* Entries in use. */
+    block_sector_t parent;              /* Parent directory's inode. */
+    uint32_t unused[122];               /* Not used. */
+  };
+
+/* Entries per bucket. */
+#define BUCKET_ENTRIES 25
+
+/* Hashed directory bucket.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_bucket
+  {
+    uint32_t next;                      /* Overflow bucket's block, or 0. */
+    struct dir_entry entries[BUCKET_ENTRIES]; /* Entries. */
+    uint8_t unused[8];                  /* Not used. */
+  };
+
+/* Result of searching a directory. */
+enum lookup_result
+  {
+    LOOKUP_FOUND,                       /* Name is present. */
+    LOOKUP_ABSENT,                      /* Name is not present. */
+    LOOKUP_ERROR                        /* Out of memory, can't tell. */
+  };
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, as a subdirectory of the directory whose inode
+   is in PARENT.  Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_header *h;
+  struct inode *inode;
+  bool success = false;
+
+  ASSERT (sizeof (struct dir_header) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct dir_bucket) == BLOCK_SECTOR_SIZE);
+
+  h = calloc (1, sizeof *h);
+  if (h == NULL)
+    return false;
+  h->magic = DIR_MAGIC;
+  h->base_cnt = DIV_ROUND_UP (entry_cnt, BUCKET_ENTRIES);
+  if (h->base_cnt < MIN_BUCKETS)
+    h->base_cnt = MIN_BUCKETS;
+  else if (h->base_cnt > MAX_BUCKETS)
+    h->base_cnt = MAX_BUCKETS;
+  h->parent = parent;
+
+  /* Forget names cached for any directory that used to live in
+     SECTOR. */
+  dcache_purge (sector);
+
+  if (inode_create (sector, 0, true))
+    {
+      inode = inode_open (sector);
+      success = (inode != NULL
+                 && inode_write_at (inode, h, sizeof *h, 0) == sizeof *h);
+      inode_close (inode);
+    }
+  free (h);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,21 +202,132 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Reads the header of DIR into *H.  Returns true if DIR is a
+   hashed directory, false if it is linear. */
+static bool
+read_header (const struct dir *dir, struct dir_header *h) 
+{
+  off_t size = offsetof (struct dir_header, unused);
+
+  return (inode_read_at (dir->inode, h, size, 0) == size
+          && h->magic == DIR_MAGIC);
+}
+
+/* Reads bucket BLOCK of hashed directory DIR into *B.  Parts of
+   the bucket past end of file read as zeros. */
+static void
+read_bucket (const struct dir *dir, uint32_t block, struct dir_bucket *b) 
+{
+  off_t size = inode_read_at (dir->inode, b, sizeof *b,
+                              block * BLOCK_SECTOR_SIZE);
+  memset ((uint8_t *) b + size, 0, sizeof *b - size);
+}
+
+/* Returns the number of buckets in a hashed directory whose
+   header is H, not counting overflow buckets. */
+static uint32_t
+bucket_cnt (const struct dir_header *h) 
+{
+  return h->base_cnt + h->split;
+}
+
+/* Returns the block of the bucket where NAME belongs in a hashed
+   directory whose header is H. */
+static uint32_t
+name_bucket (const struct dir_header *h, const char *name) 
+{
+  unsigned hash = hash_string (name);
+  uint32_t bucket = hash % h->base_cnt;
+
+  if (bucket < h->split)
+    bucket = hash % (2 * h->base_cnt);
+  return 1 + bucket;
+}
+
+/* Writes header H into hashed directory DIR.  Returns true if
+   successful, false on failure. */
+static bool
+write_header (struct dir *dir, const struct dir_header *h) 
+{
+  off_t size = offsetof (struct dir_header, unused);
+
+  return inode_write_at (dir->inode, h, size, 0) == size;
+}
+
+/* Returns the byte offset in a hashed directory of entry IDX in
+   bucket BLOCK. */
+static off_t
+entry_ofs (uint32_t block, size_t idx) 
+{
+  return (block * BLOCK_SECTOR_SIZE + offsetof (struct dir_bucket, entries)
+          + idx * sizeof (struct dir_entry));
+}
+
+/* Searches hashed directory DIR, whose header is H, for NAME.
+   If found, returns LOOKUP_FOUND, sets *EP to the entry if EP is
+   non-null, and sets *OFSP to its byte offset if OFSP is
+   non-null.  If NAME is not in DIR, returns LOOKUP_ABSENT and, if
+   FREEP is non-null, sets *FREEP to the offset of a free entry in
+   NAME's chain, or to 0 if there is none, and sets *LASTP to the
+   chain's last bucket.  Returns LOOKUP_ERROR, without setting
+   anything, if memory cannot be allocated for the search. */
+static enum lookup_result
+hashed_lookup (const struct dir *dir, const struct dir_header *h,
+               const char *name, struct dir_entry *ep, off_t *ofsp,
+               off_t *freep, uint32_t *lastp) 
+{
+  struct dir_bucket *b = malloc (sizeof *b);
+  uint32_t block = name_bucket (h, name);
+  enum lookup_result result = LOOKUP_ABSENT;
+
+  if (b == NULL)
+    return LOOKUP_ERROR;
+  if (freep != NULL)
+    *freep = 0;
+  for (;;)
+    {
+      size_t i;
+
+      read_bucket (dir, block, b);
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        {
+          struct dir_entry *e = &b->entries[i];
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = entry_ofs (block, i);
+              result = LOOKUP_FOUND;
+              goto done;
+            }
+          if (!e->in_use && freep != NULL && *freep == 0)
+            *freep = entry_ofs (block, i);
+        }
+      if (b->next == 0)
+        break;
+      block = b->next;
+    }
+  if (lastp != NULL)
+    *lastp = block;
+
+ done:
+  free (b);
+  return result;
+}
+
+/* Searches linear directory DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
    otherwise, returns false and ignores EP and OFSP. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+linear_lookup (const struct dir *dir, const char *name,
+               struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
   size_t ofs;
   
-  ASSERT (dir != NULL);
-  ASSERT (name != NULL);
-
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
@@ -111,89 +341,357 @@ lookup (const struct dir *dir, const char *name,
   return false;
 }
 
+/* Searches DIR for a file with the given NAME.
+   If successful, returns LOOKUP_FOUND, sets *EP to the directory
+   entry if EP is non-null, and sets *OFSP to the byte offset of
+   the directory entry if OFSP is non-null.
+   Otherwise, returns LOOKUP_ABSENT, or LOOKUP_ERROR if the search
+   could not be completed, and ignores EP and OFSP. */
+static enum lookup_result
+lookup (const struct dir *dir, const char *name,
+        struct dir_entry *ep, off_t *ofsp) 
+{
+  struct dir_header h;
+
+  ASSERT (dir != NULL);
+  ASSERT (name != NULL);
+
+  if (read_header (dir, &h))
+    return hashed_lookup (dir, &h, name, ep, ofsp, NULL, NULL);
+  else if (linear_lookup (dir, name, ep, ofsp))
+    return LOOKUP_FOUND;
+  else
+    return LOOKUP_ABSENT;
+}
+
+/* Returns the sector of the inode of DIR's parent directory. */
+static block_sector_t
+parent_sector (const struct dir *dir) 
+{
+  struct dir_header h;
+
+  return read_header (dir, &h) ? h.parent : ROOT_DIR_SECTOR;
+}
+
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   NAME may be "." or "..", for DIR itself or its parent.  A
+   directory that has been removed contains nothing, not even
+   these.
+   Consults the directory entry cache first, and records what it
+   finds there, whether or not NAME exists, unless the search
+   fails for lack of memory.
+   Holds DIR's directory lock until the inode is open, so that
+   NAME cannot be removed, and its inode freed, in between. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector, sector;
   struct dir_entry e;
+  enum lookup_result result;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  inode_lock_dir (dir->inode);
+  dir_sector = inode_get_inumber (dir->inode);
+  if (inode_is_removed (dir->inode))
+    sector = DCACHE_ABSENT;
+  else if (!strcmp (name, "."))
+    sector = dir_sector;
+  else if (!strcmp (name, ".."))
+    sector = parent_sector (dir);
+  else if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      result = lookup (dir, name, &e, NULL);
+      sector = result == LOOKUP_FOUND ? e.inode_sector : DCACHE_ABSENT;
+      if (result != LOOKUP_ERROR)
+        dcache_insert (dir_sector, name, sector);
+    }
+
+  if (sector != DCACHE_ABSENT)
+    *inode = inode_open (sector);
   else
     *inode = NULL;
+  inode_unlock_dir (dir->inode);
 
   return *inode != NULL;
 }
 
+/* Splits bucket H->split of hashed directory DIR, whose header
+   is H, moving the entries that now hash to the new bucket
+   H->base_cnt + H->split into it, and updates H.  The new
+   bucket's overflow buckets are ones the old bucket's chain no
+   longer needs, so no new ones are allocated.  Returns true if
+   successful, false if DIR already has MAX_BUCKETS buckets or a
+   disk or memory error occurs, in which case nothing changes. */
+static bool
+split_bucket (struct dir *dir, struct dir_header *h) 
+{
+  uint32_t old_block = 1 + h->split;
+  uint32_t new_block = 1 + bucket_cnt (h);
+  struct dir_bucket *b = malloc (sizeof *b);
+  struct dir_entry *entries = NULL;
+  uint32_t *chain = NULL;
+  size_t entry_cnt = 0, chain_cnt = 0;
+  size_t stay_cnt, stay_blocks, move_blocks, keep_cnt, e, c, i;
+  uint32_t block;
+  bool success = false;
+
+  if (b == NULL || bucket_cnt (h) >= MAX_BUCKETS)
+    goto done;
+
+  /* Read in the old bucket's chain. */
+  block = old_block;
+  do
+    {
+      uint32_t *new_chain = realloc (chain, (chain_cnt + 1) * sizeof *chain);
+      struct dir_entry *new_entries
+        = realloc (entries, (entry_cnt + BUCKET_ENTRIES) * sizeof *entries);
+      if (new_chain != NULL)
+        chain = new_chain;
+      if (new_entries != NULL)
+        entries = new_entries;
+      if (new_chain == NULL || new_entries == NULL)
+        goto done;
+
+      chain[chain_cnt++] = block;
+      read_bucket (dir, block, b);
+      for (i = 0; i < BUCKET_ENTRIES; i++)
+        if (b->entries[i].in_use)
+          entries[entry_cnt++] = b->entries[i];
+      block = b->next;
+    }
+  while (block != 0);
+
+  /* Put the entries that stay first, then those that move. */
+  stay_cnt = 0;
+  for (i = 0; i < entry_cnt; i++)
+    if (1 + hash_string (entries[i].name) % (2 * h->base_cnt) == old_block)
+      {
+        struct dir_entry tmp = entries[stay_cnt];
+        entries[stay_cnt++] = entries[i];
+        entries[i] = tmp;
+      }
+  stay_blocks = DIV_ROUND_UP (stay_cnt, BUCKET_ENTRIES);
+  move_blocks = DIV_ROUND_UP (entry_cnt - stay_cnt, BUCKET_ENTRIES);
+  if (stay_blocks == 0)
+    stay_blocks = 1;
+
+  /* Write the new bucket, followed by old overflow buckets past
+     the ones the entries that stay need.  Only the first write,
+     to a block the directory has never used, can fail.  If no
+     entries move, the new bucket is left unwritten, and reads as
+     empty. */
+  e = stay_cnt;
+  c = stay_blocks;
+  block = new_block;
+  for (i = 0; i < move_blocks; i++)
+    {
+      size_t n = entry_cnt - e < BUCKET_ENTRIES ? entry_cnt - e
+                                                : BUCKET_ENTRIES;
+      memset (b, 0, sizeof *b);
+      memcpy (b->entries, entries + e, n * sizeof *entries);
+      e += n;
+      if (i + 1 < move_blocks)
+        b->next = chain[c++];
+      if (inode_write_at (dir->inode, b, sizeof *b,
+                          block * BLOCK_SECTOR_SIZE) != sizeof *b)
+        goto done;
+      block = b->next;
+    }
+
+  /* Rewrite the old bucket's chain with the entries that stay,
+     followed by any overflow buckets that nobody took, now
+     empty.  Drop the ones the new bucket took from CHAIN. */
+  memmove (chain + stay_blocks, chain + c, (chain_cnt - c) * sizeof *chain);
+  keep_cnt = chain_cnt - (c - stay_blocks);
+  e = 0;
+  for (i = 0; i < keep_cnt; i++)
+    {
+      size_t n = stay_cnt - e < BUCKET_ENTRIES ? stay_cnt - e
+                                               : BUCKET_ENTRIES;
+      memset (b, 0, sizeof *b);
+      memcpy (b->entries, entries + e, n * sizeof *entries);
+      e += n;
+      if (i + 1 < keep_cnt)
+        b->next = chain[i + 1];
+      inode_write_at (dir->inode, b, sizeof *b,
+                      chain[i] * BLOCK_SECTOR_SIZE);
+    }
+
+  if (++h->split == h->base_cnt)
+    {
+      h->base_cnt *= 2;
+      h->split = 0;
+    }
+  write_header (dir, h);
+  success = true;
+
+ done:
+  free (chain);
+  free (entries);
+  free (b);
+  return success;
+}
+
+/* Finds a place for a new entry named NAME in hashed directory
+   DIR, whose header is H, and returns its byte offset, or 0 if
+   NAME is already in use or a disk or memory error occurs.
+   Splits a bucket first if the new entry would make the buckets
+   too full or if NAME's chain has no free entry.  If the chain
+   still has none, chains a new overflow bucket onto it. */
+static off_t
+hashed_slot (struct dir *dir, struct dir_header *h, const char *name) 
+{
+  off_t ofs;
+  uint32_t last, block;
+  bool full;
+
+  if (hashed_lookup (dir, h, name, NULL, NULL, &ofs, &last)
+      != LOOKUP_ABSENT)
+    return 0;
+
+  full = ((uint64_t) (h->entry_cnt + 1) * 100
+          > (uint64_t) bucket_cnt (h) * BUCKET_ENTRIES * MAX_LOAD);
+  if ((ofs == 0 || full) && split_bucket (dir, h)
+      && (hashed_lookup (dir, h, name, NULL, NULL, &ofs, &last)
+          != LOOKUP_ABSENT))
+    return 0;
+  if (ofs != 0)
+    return ofs;
+
+  /* Append an overflow bucket.  Its entries, past end of file,
+     read as free.  Count it in the header before chaining it
+     from LAST, so that a failure in between leaves at worst an
+     unused bucket. */
+  block = OVERFLOW_BLOCK + h->overflow_cnt++;
+  if (!write_header (dir, h))
+    {
+      h->overflow_cnt--;
+      return 0;
+    }
+  if (inode_write_at (dir->inode, &block, sizeof block,
+                      last * BLOCK_SECTOR_SIZE) != sizeof block)
+    return 0;
+  return entry_ofs (block, 0);
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long, "." or ".."), if DIR
+   has been removed, or if a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_header h;
   struct dir_entry e;
   off_t ofs;
+  bool hashed;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (*name == '\0' || strlen (name) > NAME_MAX
+      || !strcmp (name, ".") || !strcmp (name, ".."))
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  inode_lock_dir (dir->inode);
+  if (inode_is_removed (dir->inode))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  hashed = read_header (dir, &h);
+  if (hashed)
+    {
+      /* Find a free slot in NAME's bucket chain, which also
+         checks that NAME is not in use. */
+      ofs = hashed_slot (dir, &h, name);
+      if (ofs == 0)
+        goto done;
+    }
+  else
+    {
+      /* Check that NAME is not in use. */
+      if (linear_lookup (dir, name, NULL, NULL))
+        goto done;
+
+      /* Set OFS to offset of free slot.
+         If there are no free slots, then it will be set to the
+         current end-of-file.
      
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+         inode_read_at() will only return a short read at end of
+         file.  Otherwise, we'd need to verify that we didn't get
+         a short read due to something intermittent such as low
+         memory. */
+      for (ofs = 0;
+           inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+           ofs += sizeof e) 
+        if (!e.in_use)
+          break;
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    {
+      dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+      if (hashed)
+        {
+          h.entry_cnt++;
+          write_header (dir, &h);
+        }
+    }
 
  done:
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
+/* Returns true if directory INODE contains no entries, false
+   otherwise. */
+static bool
+is_empty (struct inode *inode) 
+{
+  struct dir dir;
+  char name[NAME_MAX + 1];
+
+  dir.inode = inode;
+  dir.pos = 0;
+  return !dir_readdir (&dir, name);
+}
+
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs if
+   there is no file with the given NAME or if NAME is a directory
+   that is not empty.  A directory that is removed while open
+   stays usable, but empty, until it is closed. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_header h;
   struct dir_entry e;
   struct inode *inode = NULL;
+  bool is_dir = false;
   bool success = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock_dir (dir->inode);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (lookup (dir, name, &e, &ofs) != LOOKUP_FOUND)
     goto done;
 
   /* Open inode. */
@@ -201,28 +699,94 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Refuse to remove a directory that is not empty.  Holding its
+     directory lock, after ours, keeps anything from being added
+     to it until it is marked removed. */
+  is_dir = inode_is_dir (inode);
+  if (is_dir)
+    {
+      inode_lock_dir (inode);
+      if (!is_empty (inode))
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
+  dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_ABSENT);
+  if (read_header (dir, &h))
+    {
+      h.entry_cnt--;
+      write_header (dir, &h);
+    }
+
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  if (is_dir)
+    inode_unlock_dir (inode);
   inode_close (inode);
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
+/* Sets DIR's position, as returned by dir_tell(), to POS. */
+void
+dir_seek (struct dir *dir, off_t pos) 
+{
+  ASSERT (pos >= 0);
+  dir->pos = pos;
+}
+
+/* Returns DIR's position, for a later dir_seek(). */
+off_t
+dir_tell (struct dir *dir) 
+{
+  return dir->pos;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct dir_header h;
   struct dir_entry e;
 
+  if (read_header (dir, &h))
+    {
+      /* DIR->pos counts entries, starting from the first
+         bucket, and skips from the last bucket to the first
+         overflow bucket.  Entries that a split moves while DIR
+         is being read may be returned twice or not at all. */
+      for (;;)
+        {
+          uint32_t block = 1 + dir->pos / BUCKET_ENTRIES;
+          off_t ofs;
+
+          if (block > bucket_cnt (&h) && block < OVERFLOW_BLOCK)
+            {
+              block = OVERFLOW_BLOCK;
+              dir->pos = (block - 1) * BUCKET_ENTRIES;
+            }
+          if (block >= OVERFLOW_BLOCK + h.overflow_cnt)
+            return false;
+          ofs = entry_ofs (block, dir->pos % BUCKET_ENTRIES);
+          dir->pos++;
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+              && e.in_use)
+            {
+              strlcpy (name, e.name, NAME_MAX + 1);
+              return true;
+            }
+        }
+    }
+
   while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
     {
       dir->pos += sizeof e;
@@ -1,16 +1,25 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window limits, in sectors. */
+#define RA_MIN 2
+#define RA_MAX 16
+
 /* An open file. */
 struct file 
   {
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_pos;               /* Where a sequential read would start. */
+    int ra_window;              /* Read-ahead window in sectors, or 0. */
   };
 
+static void read_ahead (struct file *, off_t ofs, off_t bytes_read);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +32,8 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_pos = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -69,6 +80,7 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  read_ahead (file, file->pos, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
@@ -81,15 +93,16 @@ file_read (struct file *file, void *buffer, off_t size)
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) 
 {
-  return inode_read_at (file->inode, buffer, size, file_ofs);
+  off_t bytes_read = inode_read_at (file->inode, buffer, size, file_ofs);
+  read_ahead (file, file_ofs, bytes_read);
+  return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file extends the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +115,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -166,3 +178,25 @@ file_tell (struct file *file)
   ASSERT (file != NULL);
   return file->pos;
 }
+
+/* Notes that BYTES_READ bytes were just read from FILE at offset
+   OFS, and asks for the sectors that follow to be read into the
+   buffer cache in the background if FILE is being read
+   sequentially.  Each read that picks up where the last one left
+   off doubles the read-ahead window, up to RA_MAX sectors; any
+   other read closes it. */
+static void
+read_ahead (struct file *file, off_t ofs, off_t bytes_read) 
+{
+  if (bytes_read > 0 && ofs == file->ra_pos)
+    file->ra_window = (file->ra_window == 0 ? RA_MIN
+                       : file->ra_window * 2 < RA_MAX ? file->ra_window * 2
+                       : RA_MAX);
+  else
+    file->ra_window = 0;
+  file->ra_pos = ofs + bytes_read;
+
+  if (file->ra_window > 0)
+    inode_read_ahead (file->inode, file->ra_pos,
+                      file->ra_window * BLOCK_SECTOR_SIZE);
+}
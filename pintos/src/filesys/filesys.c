@@ -2,10 +2,13 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -23,6 +26,8 @@ filesys_init (bool format)
 
   inode_init ();
   free_map_init ();
+  cache_init ();
+  dcache_init ();
 
   if (format) 
     do_format ();
@@ -35,21 +40,122 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  inode_flush ();
   free_map_close ();
+  cache_flush ();
 }
 
-/* Creates a file named NAME with the given INITIAL_SIZE.
-   Returns true if successful, false otherwise.
-   Fails if a file named NAME already exists,
-   or if internal memory allocation fails. */
-bool
-filesys_create (const char *name, off_t initial_size) 
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
 {
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX character from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0')
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++;
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Looks up NAME in DIR, which it closes, and returns the
+   directory it names, or a null pointer if NAME does not exist
+   or is not a directory. */
+static struct dir *
+descend (struct dir *dir, const char *name)
+{
+  struct inode *inode;
+
+  dir_lookup (dir, name, &inode);
+  dir_close (dir);
+  if (inode != NULL && !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return NULL;
+    }
+  return dir_open (inode);
+}
+
+/* Follows PATH up to, but not including, its last component,
+   which it copies into NAME, and returns the directory that
+   should contain it.  If PATH has no components at all (e.g.
+   "/"), sets NAME to the empty string and returns the directory
+   PATH names.  Returns a null pointer if PATH is empty or
+   malformed or if a directory along the way does not exist.
+   The caller must close the returned directory.
+
+   A PATH that begins with "/" is resolved from the root
+   directory, and any other PATH from the current thread's
+   working directory, so that resolving a relative path only
+   visits the components it names. */
+static struct dir *
+resolve (const char *path, char name[NAME_MAX + 1])
+{
+  struct thread *cur = thread_current ();
+  char part[NAME_MAX + 1];
+  struct dir *dir;
+  int result;
+
+  if (*path == '\0')
+    return NULL;
+  if (*path == '/' || cur->cwd == NULL)
+    dir = dir_open_root ();
+  else
+    dir = dir_reopen (cur->cwd);
+
+  *name = '\0';
+  while (dir != NULL && (result = get_next_part (part, &path)) != 0)
+    {
+      if (result < 0)
+        {
+          dir_close (dir);
+          return NULL;
+        }
+      if (*name != '\0')
+        dir = descend (dir, name);
+      strlcpy (name, part, NAME_MAX + 1);
+    }
+  return dir;
+}
+
+/* Creates a file or, if IS_DIR is true, a directory named PATH,
+   with the given INITIAL_SIZE.  Returns true if successful,
+   false otherwise. */
+static bool
+create (const char *path, off_t initial_size, bool is_dir) 
+{
+  char name[NAME_MAX + 1];
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
+  struct dir *dir = resolve (path, name);
+  block_sector_t dir_sector = (dir != NULL
+                               ? inode_get_inumber (dir_get_inode (dir))
+                               : ROOT_DIR_SECTOR);
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
+                  && *name != '\0'
+                  && free_map_allocate_near (dir_sector, 1, &inode_sector)
+                  && (is_dir
+                      ? dir_create (inode_sector, 16, dir_sector)
+                      : inode_create (inode_sector, initial_size, false))
                   && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
@@ -58,7 +164,27 @@ filesys_create (const char *name, off_t initial_size)
   return success;
 }
 
-/* Opens the file with the given NAME.
+/* Creates a file named NAME with the given INITIAL_SIZE.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_create (const char *name, off_t initial_size) 
+{
+  return create (name, initial_size, false);
+}
+
+/* Creates a directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name) 
+{
+  return create (name, 0, true);
+}
+
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -66,11 +192,17 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char part[NAME_MAX + 1];
+  struct dir *dir = resolve (name, part);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    {
+      if (*part != '\0')
+        dir_lookup (dir, part, &inode);
+      else
+        inode = inode_reopen (dir_get_inode (dir));
+    }
   dir_close (dir);
 
   return file_open (inode);
@@ -78,25 +210,46 @@ filesys_open (const char *name)
 
 /* Deletes the file named NAME.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if no file named NAME exists, if NAME is a directory
+   that is not empty, or if an internal memory allocation
+   fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char part[NAME_MAX + 1];
+  struct dir *dir = resolve (name, part);
+  bool success = dir != NULL && *part != '\0' && dir_remove (dir, part);
   dir_close (dir); 
 
   return success;
 }
-
+
+/* Changes the current thread's working directory to NAME.
+   Returns true if successful, false on failure. */
+bool
+filesys_chdir (const char *name) 
+{
+  struct thread *cur = thread_current ();
+  char part[NAME_MAX + 1];
+  struct dir *dir = resolve (name, part);
+
+  if (dir != NULL && *part != '\0')
+    dir = descend (dir, part);
+  if (dir == NULL)
+    return false;
+
+  dir_close (cur->cwd);
+  cur->cwd = dir;
+  return true;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -1,52 +1,236 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Free map bits held by each sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Sectors per allocation group. */
+#define GROUP_SECTORS 512
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static size_t free_cnt;              /* Number of free sectors. */
+static size_t reserved_cnt;          /* Free sectors set aside. */
+
+/* Sectors of the free map file that are out of date, one bit per
+   sector.  Allocating or releasing sectors only updates the
+   in-memory free map and marks the file sectors that hold the
+   changed bits here; free_map_flush() writes just those
+   sectors, through the buffer cache, instead of the whole
+   bitmap. */
+static struct bitmap *dirty_map;
+
+/* The disk is divided into allocation groups of GROUP_SECTORS
+   sectors each.  free_map_allocate_near() looks for space in
+   the group that holds its goal sector first, then in the
+   following groups, so that related sectors end up close
+   together.  GROUP_FREE counts the free sectors in each group,
+   so that groups too full to help are skipped without looking
+   at their bits. */
+static size_t group_cnt;             /* Number of groups. */
+static size_t *group_free;           /* Free sectors in each group. */
+
+/* Protects all of the above. */
+static struct lock free_map_lock;
+
+static void mark_dirty (size_t start, size_t cnt);
+static void count_groups (void);
+static void adjust_groups (size_t start, size_t cnt, bool allocated);
+static size_t scan_group (size_t group, size_t start, size_t cnt);
+static size_t run_limit (size_t limit, size_t cnt);
+static bool allocate_near (block_sector_t goal, size_t cnt, size_t reserved,
+                           block_sector_t *sectorp);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  size_t bit_cnt = block_size (fs_device);
+
+  lock_init (&free_map_lock);
+  free_map = bitmap_create (bit_cnt);
+  dirty_map = bitmap_create (DIV_ROUND_UP (bit_cnt, BITS_PER_SECTOR));
+  group_cnt = DIV_ROUND_UP (bit_cnt, GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (free_map == NULL || dirty_map == NULL || group_free == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  count_groups ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available or if allocating them would eat into
+   reserved sectors. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (free_cnt - reserved_cnt >= cnt)
+    sector = bitmap_scan_and_flip_next (free_map, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      adjust_groups (sector, cnt, true);
+      *sectorp = sector;
+    }
+  lock_release (&free_map_lock);
+  return sector != BITMAP_ERROR;
+}
+
+/* Allocates CNT consecutive sectors from the free map, as close
+   after GOAL as possible, and stores the first into *SECTORP.
+   Looks in GOAL's allocation group first, starting at GOAL and
+   then from the start of the group, then in each following
+   group in turn, wrapping around, and finally anywhere at all,
+   for a run that spans groups.
+   Returns true if successful, false if not enough consecutive
+   sectors were available or if allocating them would eat into
+   reserved sectors. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate_near (goal, cnt, 0, sectorp);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Allocates CNT consecutive sectors as free_map_allocate_near()
+   does, but takes them out of sectors set aside earlier with
+   free_map_reserve(), and gives up CNT sectors of that
+   reservation in the same step, so that no other thread can
+   take the sectors in between.  Returns true if successful.
+   Returns false, leaving the reservation as it was, if not
+   enough consecutive sectors were available. */
+bool
+free_map_allocate_reserved (block_sector_t goal, size_t cnt,
+                            block_sector_t *sectorp)
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  success = allocate_near (goal, cnt, cnt, sectorp);
+  if (success)
+    reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Does the work of free_map_allocate_near() and
+   free_map_allocate_reserved(), counting RESERVED of the sectors
+   already set aside as available to this allocation.  The free
+   map lock must be held. */
+static bool
+allocate_near (block_sector_t goal, size_t cnt, size_t reserved,
+               block_sector_t *sectorp)
+{
+  size_t sector = BITMAP_ERROR;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+
+  if (cnt > 0 && free_cnt - (reserved_cnt - reserved) >= cnt)
+    {
+      size_t first = goal / GROUP_SECTORS;
+      size_t i;
+
+      sector = scan_group (first, goal, cnt);
+      for (i = 1; sector == BITMAP_ERROR && i < group_cnt; i++)
+        {
+          size_t group = (first + i) % group_cnt;
+          sector = scan_group (group, group * GROUP_SECTORS, cnt);
+        }
+      if (sector == BITMAP_ERROR)
+        sector = bitmap_scan (free_map, 0, cnt, false);
     }
   if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      adjust_groups (sector, cnt, true);
+      *sectorp = sector;
+    }
   return sector != BITMAP_ERROR;
 }
 
+/* Sets aside CNT free sectors, without choosing which, so that
+   a later free_map_allocate() of CNT sectors after
+   free_map_unreserve() cannot fail for lack of space (although
+   it may for lack of contiguous space).  Used for delayed
+   allocation.  Returns true if successful, false if there are
+   not enough free sectors. */
+bool
+free_map_reserve (size_t cnt) 
+{
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = free_cnt - reserved_cnt >= cnt;
+  if (success)
+    reserved_cnt += cnt;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Returns CNT sectors set aside by free_map_reserve() to the
+   pool. */
+void
+free_map_unreserve (size_t cnt) 
+{
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt >= cnt);
+  reserved_cnt -= cnt;
+  lock_release (&free_map_lock);
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  adjust_groups (sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file that changed since
+   they were last written.  Does nothing if the free map file is
+   not open. */
+void
+free_map_flush (void)
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (dirty_map); i++)
+      if (bitmap_test (dirty_map, i))
+        {
+          size_t start = i * BITS_PER_SECTOR;
+          size_t cnt = (bit_cnt - start < BITS_PER_SECTOR
+                        ? bit_cnt - start : BITS_PER_SECTOR);
+          if (bitmap_write_range (free_map, free_map_file, start, cnt))
+            bitmap_reset (dirty_map, i);
+        }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +242,22 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
+  bitmap_set_all (dirty_map, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -73,13 +266,109 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  Writing all of it leaves none of the
+     file's sectors unwritten, so later flushes never need to
+     allocate. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
+}
+
+/* Marks the free map file sectors that hold the CNT bits
+   starting at START as out of date. */
+static void
+mark_dirty (size_t start, size_t cnt)
+{
+  size_t first = start / BITS_PER_SECTOR;
+  size_t last = (start + cnt - 1) / BITS_PER_SECTOR;
+
+  ASSERT (cnt > 0);
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
+
+/* Recomputes the free sector counts from the free map. */
+static void
+count_groups (void) 
+{
+  size_t bit_cnt = bitmap_size (free_map);
+  size_t i;
+
+  free_cnt = 0;
+  for (i = 0; i < group_cnt; i++)
+    {
+      size_t start = i * GROUP_SECTORS;
+      size_t cnt = (bit_cnt - start < GROUP_SECTORS
+                    ? bit_cnt - start : GROUP_SECTORS);
+      group_free[i] = bitmap_count (free_map, start, cnt, false);
+      free_cnt += group_free[i];
+    }
+}
+
+/* Accounts for the CNT sectors starting at START having been
+   allocated, if ALLOCATED is true, or released, otherwise. */
+static void
+adjust_groups (size_t start, size_t cnt, bool allocated) 
+{
+  size_t end = start + cnt;
+
+  if (allocated)
+    free_cnt -= cnt;
+  else
+    free_cnt += cnt;
+  mark_dirty (start, cnt);
+
+  while (start < end)
+    {
+      size_t group = start / GROUP_SECTORS;
+      size_t group_end = (group + 1) * GROUP_SECTORS;
+      size_t n = (end < group_end ? end : group_end) - start;
+
+      if (allocated)
+        group_free[group] -= n;
+      else
+        group_free[group] += n;
+      start += n;
+    }
+}
+
+/* Returns the first sector of a run of CNT free sectors that
+   begins in GROUP, at or after START if possible, or
+   BITMAP_ERROR if there is none.  Looks only at the bits of runs
+   that begin in GROUP, although a run may extend past it. */
+static size_t
+scan_group (size_t group, size_t start, size_t cnt) 
+{
+  size_t group_start = group * GROUP_SECTORS;
+  size_t group_end = group_start + GROUP_SECTORS;
+  size_t sector;
+
+  if (group_free[group] == 0
+      || (cnt <= GROUP_SECTORS && group_free[group] < cnt))
+    return BITMAP_ERROR;
+
+  sector = bitmap_scan_range (free_map, start, run_limit (group_end, cnt),
+                              cnt, false);
+  if (sector == BITMAP_ERROR && start > group_start)
+    sector = bitmap_scan_range (free_map, group_start,
+                                run_limit (start, cnt), cnt, false);
+  return sector;
+}
+
+/* Returns the end of the bits to scan for a run of CNT sectors
+   that begins before LIMIT, that is, LIMIT + CNT - 1, but no
+   further than the end of the free map. */
+static size_t
+run_limit (size_t limit, size_t cnt) 
+{
+  size_t bit_cnt = bitmap_size (free_map);
+
+  if (limit < bit_cnt && cnt - 1 < bit_cnt - limit)
+    return limit + cnt - 1;
+  return bit_cnt;
 }
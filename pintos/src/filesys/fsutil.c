@@ -4,9 +4,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "devices/timer.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
@@ -221,3 +223,93 @@ fsutil_append (char **argv)
   file_close (src);
   free (buffer);
 }
+
+/* Directory that holds fsutil_open_bench()'s files. */
+#define OPEN_BENCH_DIR "/open-bench"
+
+/* Stores the name of fsutil_open_bench()'s file I, of SIZE bytes
+   at most, in NAME. */
+static void
+open_bench_name (char *name, size_t size, int i) 
+{
+  snprintf (name, size, "%s/f%d", OPEN_BENCH_DIR, i);
+}
+
+/* Prints the time since START taken to do WHAT to CNT files. */
+static void
+open_bench_report (const char *what, int cnt, int64_t start) 
+{
+  printf ("%s, %d files: %"PRId64" ticks\n", what, cnt,
+          timer_elapsed (start));
+}
+
+/* Benchmarks the open inode table: creates ARGV[1] files in a new
+   directory, then times opening all of them by name, finding
+   each one's inode again with inode_open() while all of them are
+   open, and closing them, so that the table holds every one of
+   them at its fullest.  Removes the files afterward. */
+void
+fsutil_open_bench (char **argv) 
+{
+  int cnt = atoi (argv[1]);
+  struct file **files;
+  struct inode **inodes;
+  char name[32];
+  int64_t start;
+  int i;
+
+  if (cnt <= 0)
+    PANIC ("open-bench: bad file count \"%s\"", argv[1]);
+  files = malloc (cnt * sizeof *files);
+  inodes = malloc (cnt * sizeof *inodes);
+  if (files == NULL || inodes == NULL)
+    PANIC ("open-bench: couldn't allocate arrays");
+
+  printf ("Creating %d files in %s...\n", cnt, OPEN_BENCH_DIR);
+  if (!filesys_mkdir (OPEN_BENCH_DIR))
+    PANIC ("%s: mkdir failed", OPEN_BENCH_DIR);
+  for (i = 0; i < cnt; i++)
+    {
+      open_bench_name (name, sizeof name, i);
+      if (!filesys_create (name, 0))
+        PANIC ("%s: create failed", name);
+    }
+
+  start = timer_ticks ();
+  for (i = 0; i < cnt; i++)
+    {
+      open_bench_name (name, sizeof name, i);
+      files[i] = filesys_open (name);
+      if (files[i] == NULL)
+        PANIC ("%s: open failed", name);
+    }
+  open_bench_report ("open", cnt, start);
+
+  start = timer_ticks ();
+  for (i = 0; i < cnt; i++)
+    {
+      struct inode *inode = file_get_inode (files[i]);
+      inodes[i] = inode_open (inode_get_inumber (inode));
+      ASSERT (inodes[i] == inode);
+    }
+  open_bench_report ("inode_open of open inode", cnt, start);
+
+  start = timer_ticks ();
+  for (i = 0; i < cnt; i++)
+    {
+      inode_close (inodes[i]);
+      file_close (files[i]);
+    }
+  open_bench_report ("close", cnt, start);
+
+  for (i = 0; i < cnt; i++)
+    {
+      open_bench_name (name, sizeof name, i);
+      if (!filesys_remove (name))
+        PANIC ("%s: delete failed", name);
+    }
+  if (!filesys_remove (OPEN_BENCH_DIR))
+    PANIC ("%s: delete failed", OPEN_BENCH_DIR);
+  free (inodes);
+  free (files);
+}
@@ -1,23 +1,87 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of LENGTH consecutive sectors starting at START that
+   holds the file's blocks starting at block BLOCK.
+
+   An unwritten extent's sectors are allocated but have never
+   been written, so their contents on disk are garbage.  The
+   blocks read as zeros, and each one becomes written, splitting
+   the extent, when it is first written. */
+struct extent
+  {
+    uint32_t block;                     /* First block of the file. */
+    block_sector_t start;               /* First sector on disk. */
+    uint32_t length : 31;               /* Number of sectors. */
+    uint32_t unwritten : 1;             /* Never written? */
+  };
+
+/* Extents stored in the inode itself. */
+#define INLINE_EXTENTS 41
+
+/* Leaf sectors listed in the inode, and extents in each. */
+#define LEAF_MAX 123
+#define LEAF_EXTENTS 42
+
+/* Maximum number of extents in a file. */
+#define MAX_EXTENTS (LEAF_MAX * LEAF_EXTENTS)
+
+/* Reads of at least this many bytes transfer whole sectors that
+   are not cached straight from disk into the caller's buffer,
+   without caching them, one request for each run of consecutive
+   sectors.  Smaller reads, including the page-sized
+   ones that load executables, still go through the cache, so
+   that data read again soon is found there. */
+#define DIRECT_READ_MIN (16 * BLOCK_SECTOR_SIZE)
+
+/* Returned by extent_lookup() for a block with no sector. */
+#define NO_SECTOR ((block_sector_t) -1)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The file's data is described by a list of extents, sorted by
+   block and not overlapping, so that a file written in long
+   sequential runs needs only a handful of them however large it
+   grows.  Up to INLINE_EXTENTS extents are kept in the inode
+   itself.  A file with more moves them into leaf sectors of
+   LEAF_EXTENTS extents each, and the inode lists the leaves
+   instead. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    uint32_t leaf_cnt;                  /* Leaf sectors, 0 if inline. */
+    union
+      {
+        struct extent extents[INLINE_EXTENTS]; /* If leaf_cnt == 0. */
+        block_sector_t leaves[LEAF_MAX];       /* If leaf_cnt > 0. */
+      }
+    u;
+    uint32_t is_dir;                    /* Nonzero if a directory. */
+  };
+
+/* Leaf sector of extents.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.  Every leaf but
+   the last in use is full. */
+struct extent_leaf
+  {
+    uint32_t extent_cnt;                /* Number of extents. */
+    struct extent extents[LEAF_EXTENTS]; /* Extents. */
+    uint32_t unused;                    /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,80 +92,601 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+
+   While a file is open, its extents are kept sorted in EXTENTS,
+   and data.u.leaves, if in use, lists the leaf sectors they go
+   to.
+
+   Blocks written where the file has no sectors are not given
+   sectors right away.  Instead, each such "delayed" block lives
+   in the buffer cache, keyed by inode and block number.  One
+   free sector is reserved for it in the free map, and room for
+   one more extent in the inode, so that giving it a sector later
+   can never fail.  Sectors are chosen for all of
+   an inode's delayed blocks at once, when the cache cannot take
+   any more of them, when the inode is closed, or at
+   inode_flush(), which the cache's flusher thread calls every
+   few seconds.  By then a sequential writer has usually
+   written many consecutive blocks, which then get consecutive
+   sectors and become a single extent.
+
+   Blocks that were never written, because a write started past
+   end of file, have no sectors and are not delayed.  They form
+   holes that read as zeros.
+
+   Each inode has a readers-writer lock.  Reads hold it shared,
+   so any number of them may proceed at once, and writes, which
+   may change the length and the extents, hold it exclusive.
+   The directory lock is separate: the directory code holds it
+   while it looks up and then changes entries, which it does
+   with ordinary reads and writes. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    struct rwlock rwlock;               /* Protects the members below. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+    struct extent *extents;             /* Extents, data.extent_cnt used. */
+    size_t extent_cap;                  /* Number of extents allocated. */
+    bool extents_dirty;                 /* Leaves need rewriting? */
+    size_t delayed_cnt;                 /* Delayed blocks in the cache. */
+    struct lock dir_lock;               /* Serializes directory updates. */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+static bool reserve_extents (struct inode *, size_t extra);
+
+/* Returns the index of the extent in INODE that holds BLOCK or,
+   if there is none, of the first extent after BLOCK. */
+static size_t
+extent_search (const struct inode *inode, uint32_t block) 
+{
+  size_t lo = 0;
+  size_t hi = inode->data.extent_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      const struct extent *e = &inode->extents[mid];
+
+      if (block < e->block)
+        hi = mid;
+      else if (block >= e->block + e->length)
+        lo = mid + 1;
+      else
+        return mid;
+    }
+  return lo;
+}
+
+/* Returns the sector that holds BLOCK in INODE, or NO_SECTOR if
+   BLOCK has no sector.  If UNWRITTEN is nonnull, sets *UNWRITTEN
+   to true if the sector has never been written, false
+   otherwise. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+extent_lookup (const struct inode *inode, uint32_t block, bool *unwritten) 
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  size_t i = extent_search (inode, block);
+
+  if (i < inode->data.extent_cnt && block >= inode->extents[i].block)
+    {
+      const struct extent *e = &inode->extents[i];
+      if (unwritten != NULL)
+        *unwritten = e->unwritten;
+      return e->start + (block - e->block);
+    }
   else
-    return -1;
+    return NO_SECTOR;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns true if extent A ends where extent B begins, both in
+   the file and on disk, and they can be merged. */
+static bool
+extents_adjacent (const struct extent *a, const struct extent *b) 
+{
+  return (a->block + a->length == b->block
+          && a->start + a->length == b->start
+          && a->unwritten == b->unwritten);
+}
+
+/* Records that the LENGTH blocks of INODE starting at BLOCK,
+   which must not have sectors yet, are held by the LENGTH
+   sectors starting at START, which are unwritten if UNWRITTEN is
+   true.  Merges with the neighboring extents where possible.
+   Room for a new extent must have been made with
+   reserve_extents(). */
+static void
+extent_add (struct inode *inode, uint32_t block, block_sector_t start,
+            uint32_t length, bool unwritten) 
+{
+  size_t cnt = inode->data.extent_cnt;
+  size_t i = extent_search (inode, block);
+  struct extent *prev = i > 0 ? &inode->extents[i - 1] : NULL;
+  struct extent *next = i < cnt ? &inode->extents[i] : NULL;
+  struct extent new;
+
+  ASSERT (next == NULL || block + length <= next->block);
+
+  new.block = block;
+  new.start = start;
+  new.length = length;
+  new.unwritten = unwritten;
+
+  inode->extents_dirty = true;
+  if (prev != NULL && extents_adjacent (prev, &new))
+    {
+      prev->length += length;
+      if (next != NULL && extents_adjacent (prev, next))
+        {
+          prev->length += next->length;
+          memmove (next, next + 1, (cnt - i - 1) * sizeof *next);
+          inode->data.extent_cnt--;
+        }
+    }
+  else if (next != NULL && extents_adjacent (&new, next))
+    {
+      next->block = block;
+      next->start = start;
+      next->length += length;
+    }
+  else
+    {
+      struct extent *e = &inode->extents[i];
+
+      ASSERT (cnt < inode->extent_cap);
+      memmove (e + 1, e, (cnt - i) * sizeof *e);
+      *e = new;
+      inode->data.extent_cnt++;
+    }
+}
+
+/* Marks BLOCK of INODE, which must be in an unwritten extent, as
+   written, splitting the extent.  Returns true if successful,
+   false if out of memory or disk space for the extra extents. */
+static bool
+mark_written (struct inode *inode, uint32_t block) 
+{
+  struct extent e;
+  size_t i;
+
+  if (!reserve_extents (inode, 2))
+    return false;
+
+  i = extent_search (inode, block);
+  e = inode->extents[i];
+  ASSERT (i < inode->data.extent_cnt && e.unwritten && block >= e.block);
+  memmove (&inode->extents[i], &inode->extents[i + 1],
+           (inode->data.extent_cnt - i - 1) * sizeof e);
+  inode->data.extent_cnt--;
+
+  if (block > e.block)
+    extent_add (inode, e.block, e.start, block - e.block, true);
+  extent_add (inode, block, e.start + (block - e.block), 1, false);
+  if (block + 1 < e.block + e.length)
+    extent_add (inode, block + 1, e.start + (block + 1 - e.block),
+                e.block + e.length - (block + 1), true);
+  return true;
+}
+
+/* Makes room in INODE, in memory and on disk, for EXTRA extents
+   beyond those it has and those its delayed blocks may need.
+   Returns true if successful, false if out of memory or disk
+   space or if the file would have too many extents.
+
+   Room for one extent per delayed block is kept at all times, so
+   that giving sectors to delayed blocks never fails: a delayed
+   run adds at most one extent and takes at least one block out
+   of delayed_cnt. */
+static bool
+reserve_extents (struct inode *inode, size_t extra) 
+{
+  struct inode_disk *d = &inode->data;
+  size_t need = d->extent_cnt + inode->delayed_cnt + extra;
+
+  if (need > MAX_EXTENTS)
+    return false;
+
+  if (need > inode->extent_cap)
+    {
+      size_t cap = inode->extent_cap * 2;
+      struct extent *extents;
+
+      if (cap < need)
+        cap = need;
+      extents = realloc (inode->extents, cap * sizeof *extents);
+      if (extents == NULL)
+        return false;
+      inode->extents = extents;
+      inode->extent_cap = cap;
+    }
+
+  if (need > INLINE_EXTENTS)
+    {
+      uint32_t old_cnt = d->leaf_cnt;
+      size_t leaf_cnt = DIV_ROUND_UP (need, LEAF_EXTENTS);
+
+      while (d->leaf_cnt < leaf_cnt)
+        {
+          if (!free_map_allocate_near (inode->sector, 1,
+                                       &d->u.leaves[d->leaf_cnt]))
+            {
+              while (d->leaf_cnt > old_cnt)
+                free_map_release (d->u.leaves[--d->leaf_cnt], 1);
+              return false;
+            }
+          d->leaf_cnt++;
+          inode->extents_dirty = true;
+        }
+    }
+  return true;
+}
+
+/* Reads INODE's extents from disk into memory.  Returns true if
+   successful, false if out of memory. */
+static bool
+load_extents (struct inode *inode) 
+{
+  const struct inode_disk *d = &inode->data;
+  size_t i;
+
+  inode->extent_cap = d->extent_cnt > 8 ? d->extent_cnt : 8;
+  inode->extents = malloc (inode->extent_cap * sizeof *inode->extents);
+  if (inode->extents == NULL)
+    return false;
+
+  if (d->leaf_cnt == 0)
+    memcpy (inode->extents, d->u.extents,
+            d->extent_cnt * sizeof *inode->extents);
+  else
+    for (i = 0; i < d->leaf_cnt && i * LEAF_EXTENTS < d->extent_cnt; i++)
+      {
+        uint32_t cnt;
+
+        cache_read (d->u.leaves[i], &cnt,
+                    offsetof (struct extent_leaf, extent_cnt), sizeof cnt);
+        cache_read (d->u.leaves[i], inode->extents + i * LEAF_EXTENTS,
+                    offsetof (struct extent_leaf, extents),
+                    cnt * sizeof *inode->extents);
+      }
+  inode->extents_dirty = false;
+  return true;
+}
+
+/* Writes INODE to disk, along with its leaf sectors if its
+   extents changed since they were last written. */
+static void
+inode_save (struct inode *inode) 
+{
+  struct inode_disk *d = &inode->data;
+  size_t i;
+
+  if (d->leaf_cnt == 0)
+    memcpy (d->u.extents, inode->extents,
+            d->extent_cnt * sizeof *inode->extents);
+  else if (inode->extents_dirty)
+    for (i = 0; i < d->leaf_cnt; i++)
+      {
+        size_t first = i * LEAF_EXTENTS;
+        uint32_t cnt = 0;
+
+        if (first < d->extent_cnt)
+          cnt = (d->extent_cnt - first < LEAF_EXTENTS
+                 ? d->extent_cnt - first : LEAF_EXTENTS);
+        cache_write (d->u.leaves[i], &cnt,
+                     offsetof (struct extent_leaf, extent_cnt), sizeof cnt);
+        cache_write (d->u.leaves[i], inode->extents + first,
+                     offsetof (struct extent_leaf, extents),
+                     cnt * sizeof *inode->extents);
+      }
+  inode->extents_dirty = false;
+  cache_write (inode->sector, d, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Releases all of INODE's data and leaf sectors. */
+static void
+release_data (struct inode *inode) 
+{
+  struct inode_disk *d = &inode->data;
+  size_t i;
+
+  for (i = 0; i < d->extent_cnt; i++)
+    free_map_release (inode->extents[i].start, inode->extents[i].length);
+  for (i = 0; i < d->leaf_cnt; i++)
+    free_map_release (d->u.leaves[i], 1);
+  d->extent_cnt = d->leaf_cnt = 0;
+}
+
+/* Returns the sector where BLOCK of INODE would ideally go: the
+   one that keeps it in line with the nearest earlier block that
+   has a sector, or else with the inode itself, so that the file
+   stays contiguous and close to its inode. */
+static block_sector_t
+block_goal (const struct inode *inode, uint32_t block) 
+{
+  size_t i = extent_search (inode, block);
+
+  if (i > 0)
+    {
+      const struct extent *prev = &inode->extents[i - 1];
+      return prev->start + (block - prev->block);
+    }
+  return inode->sector + 1 + block;
+}
+
+/* Gives sectors to the CNT blocks of INODE starting at BLOCK,
+   none of which may have sectors yet, in runs of consecutive
+   sectors as long as the free map allows.  If DELAYED is true,
+   the blocks are delayed blocks, whose reserved space is used
+   and whose cached contents move to the new sectors; otherwise
+   the new sectors go into unwritten extents, without any
+   I/O.  Returns the number of blocks
+   given sectors, which is less than CNT only if the disk is
+   full or memory for extents runs out, neither of which can
+   happen to delayed blocks. */
+static size_t
+allocate_run (struct inode *inode, uint32_t block, size_t cnt, bool delayed) 
+{
+  size_t done = 0;
+  size_t try = cnt;
+
+  while (done < cnt)
+    {
+      block_sector_t goal, start;
+      bool success;
+      size_t i;
+
+      if (!reserve_extents (inode, delayed ? 0 : 1))
+        break;
+      if (try > cnt - done)
+        try = cnt - done;
+      goal = block_goal (inode, block + done);
+      if (delayed)
+        success = free_map_allocate_reserved (goal, try, &start);
+      else
+        success = free_map_allocate_near (goal, try, &start);
+      if (!success)
+        {
+          /* Not enough consecutive free sectors: try a shorter
+             run. */
+          if (try == 1)
+            break;
+          try /= 2;
+          continue;
+        }
+
+      if (delayed)
+        {
+          for (i = 0; i < try; i++)
+            cache_assign (inode, block + done + i, start + i);
+          inode->delayed_cnt -= try;
+        }
+      extent_add (inode, block + done, start, try, !delayed);
+      done += try;
+    }
+  return done;
+}
+
+/* Chooses sectors for all of INODE's delayed blocks and writes
+   INODE to disk.  Cannot fail, because each delayed block
+   already has a free sector reserved for it in the free map and
+   room for an extent of its own. */
+static void
+allocate_delayed (struct inode *inode) 
+{
+  uint32_t blocks[CACHE_DELAYED_MAX];
+  size_t cnt, i, j;
+
+  if (inode->delayed_cnt == 0)
+    return;
+
+  /* Sort the blocks, so that runs of consecutive blocks can get
+     consecutive sectors. */
+  cnt = cache_delayed_blocks (inode, blocks, CACHE_DELAYED_MAX);
+  for (i = 1; i < cnt; i++)
+    {
+      uint32_t block = blocks[i];
+      for (j = i; j > 0 && blocks[j - 1] > block; j--)
+        blocks[j] = blocks[j - 1];
+      blocks[j] = block;
+    }
+
+  for (i = 0; i < cnt; i = j)
+    {
+      for (j = i + 1; j < cnt && blocks[j] == blocks[j - 1] + 1; j++)
+        continue;
+      allocate_run (inode, blocks[i], j - i, true);
+    }
+  ASSERT (inode->delayed_cnt == 0);
+  inode_save (inode);
+}
+
+/* Reads SIZE bytes from BLOCK of INODE into BUFFER, starting at
+   offset OFS within the block.  Holes and unwritten sectors read
+   as zeros. */
+static void
+read_block (struct inode *inode, uint32_t block, void *buffer,
+            int ofs, int size) 
+{
+  bool unwritten;
+  block_sector_t sector = extent_lookup (inode, block, &unwritten);
+
+  /* A block without a sector is a delayed block, unless it was
+     given a sector since we looked, or else a hole. */
+  if (sector == NO_SECTOR)
+    {
+      if (cache_read_delayed (inode, block, buffer, ofs, size))
+        return;
+      sector = extent_lookup (inode, block, &unwritten);
+    }
+
+  if (sector == NO_SECTOR || unwritten)
+    memset (buffer, 0, size);
+  else
+    cache_read (sector, buffer, ofs, size);
+}
+
+/* Reads up to CNT whole blocks of INODE, starting at BLOCK, into
+   BUFFER.  If BLOCK is held by a written sector, reads the run
+   of blocks from there to the end of its extent, or CNT blocks
+   if fewer, with cache_read_direct(), so that those not cached
+   come straight from disk in a single request.  Otherwise,
+   reads just BLOCK, as read_block().  Returns the number of
+   blocks read, which is at least 1. */
+static size_t
+read_direct (struct inode *inode, uint32_t block, size_t cnt, void *buffer)
+{
+  size_t i = extent_search (inode, block);
+  const struct extent *e = &inode->extents[i];
+
+  ASSERT (cnt > 0);
+
+  if (i < inode->data.extent_cnt && block >= e->block && !e->unwritten)
+    {
+      size_t run = e->block + e->length - block;
+      if (run > cnt)
+        run = cnt;
+      cache_read_direct (e->start + (block - e->block), run, buffer);
+      return run;
+    }
+  read_block (inode, block, buffer, 0, BLOCK_SECTOR_SIZE);
+  return 1;
+}
+
+/* Writes SIZE bytes from BUFFER into BLOCK of INODE, which has
+   no sector, starting at offset OFS within the block, by making
+   BLOCK a delayed block if it is not one already.  Returns true
+   if successful.  Returns false if the cache has no room for
+   another delayed block or the disk is full, after giving
+   sectors to INODE's existing delayed blocks. */
+static bool
+write_delayed (struct inode *inode, uint32_t block, const void *buffer,
+               int ofs, int size) 
+{
+  if (cache_write_delayed (inode, block, buffer, ofs, size, false))
+    return true;
+
+  /* Reserve a sector and room for an extent for the new delayed
+     block now, while failure is still harmless. */
+  if (reserve_extents (inode, 1) && free_map_reserve (1))
+    {
+      if (cache_write_delayed (inode, block, buffer, ofs, size, true))
+        {
+          inode->delayed_cnt++;
+          return true;
+        }
+      free_map_unreserve (1);
+    }
+  allocate_delayed (inode);
+  return false;
+}
+
+/* Writes SIZE bytes from BUFFER into BLOCK of INODE, starting at
+   offset OFS within the block.  A block without a sector, past
+   end of file or in a hole, becomes a delayed block or, failing
+   that, gets a sector of its own.  Returns true if successful,
+   false if the disk is full. */
+static bool
+write_block (struct inode *inode, uint32_t block, const void *buffer,
+             int ofs, int size) 
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  bool unwritten;
+  block_sector_t sector = extent_lookup (inode, block, &unwritten);
+
+  if (sector == NO_SECTOR)
+    {
+      if (write_delayed (inode, block, buffer, ofs, size))
+        return true;
+      if (allocate_run (inode, block, 1, false) == 0)
+        return false;
+      sector = extent_lookup (inode, block, &unwritten);
+    }
+
+  /* The first write to an unwritten sector supplies the zeros
+     around the data, instead of reading garbage from disk. */
+  if (unwritten)
+    {
+      if (!mark_written (inode, block))
+        return false;
+      if (size < BLOCK_SECTOR_SIZE)
+        cache_write (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+    }
+
+  /* The buffer cache reads in the rest of the sector first if
+     the data does not cover it. */
+  cache_write (sector, buffer, ofs, size);
+  return true;
+}
+
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode' without searching every
+   open inode. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt of every inode in it.
+   Held while an inode is read in or written back on last close,
+   so that an inode is never read from disk while a stale copy is
+   still being written. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("could not create open inode table");
+  lock_init (&open_inodes_lock);
 }
 
-/* Initializes an inode with LENGTH bytes of data and
+/* Initializes an inode with LENGTH bytes of data, for a
+   directory if IS_DIR is true or an ordinary file otherwise, and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  Sectors are allocated for the data but not written:
+   they read as zeros until something is written to them.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
+  struct inode *inode;
+  size_t sectors = bytes_to_sectors (length);
+  bool success;
 
   ASSERT (length >= 0);
 
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_leaf) == BLOCK_SECTOR_SIZE);
 
+  /* Write an empty inode, then grow it in place. */
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->is_dir = is_dir;
+  cache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+  free (disk_inode);
+
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  success = allocate_run (inode, 0, sectors, false) == sectors;
+  if (success)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
+      inode->data.length = length;
+      inode_save (inode);
     }
+  else
+    release_data (inode);
+  inode_close (inode);
   return success;
 }
 
@@ -111,33 +696,46 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      goto done;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    goto done;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->delayed_cnt = 0;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->dir_lock);
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  if (!load_extents (inode))
+    {
+      free (inode);
+      inode = NULL;
+      goto done;
+    }
+  hash_insert (&open_inodes, &inode->elem);
+
+ done:
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +744,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -168,21 +770,27 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      /* Remove from inode table. */
+      hash_delete (&open_inodes, &inode->elem);
  
-      /* Deallocate blocks if removed. */
+      /* Deallocate blocks if removed, otherwise give sectors to
+         any delayed blocks. */
       if (inode->removed) 
         {
+          free_map_unreserve (cache_discard (inode));
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          release_data (inode);
         }
+      else
+        allocate_delayed (inode);
 
+      free (inode->extents);
       free (inode); 
     }
+  lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -194,6 +802,13 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Returns true if INODE has been removed, false otherwise. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -202,16 +817,17 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  bool direct = size >= DIRECT_READ_MIN;
 
+  rwlock_acquire_read (&inode->rwlock);
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Block to read, starting byte offset within block. */
+      uint32_t block = offset / BLOCK_SECTOR_SIZE;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -220,110 +836,132 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Copy the chunk out of the buffer cache or, for whole
+         sectors of a large read, perhaps straight from disk. */
+      if (direct && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          off_t left = size < inode_left ? size : inode_left;
+          chunk_size = (read_direct (inode, block, left / BLOCK_SECTOR_SIZE,
+                                     buffer + bytes_read)
+                        * BLOCK_SECTOR_SIZE);
         }
+      else
+        read_block (inode, block, buffer + bytes_read, sector_ofs,
+                    chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
+/* Starts reading the sectors holding the SIZE bytes of INODE
+   that begin at OFFSET into the buffer cache, without waiting
+   for them.  Stops at end of file. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size) 
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (end > inode->data.length)
+    end = inode->data.length;
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      bool unwritten;
+      block_sector_t sector = extent_lookup (inode,
+                                             offset / BLOCK_SECTOR_SIZE,
+                                             &unwritten);
+      if (sector != NO_SECTOR && !unwritten)
+        cache_read_ahead (sector);
+    }
+  rwlock_release_read (&inode->rwlock);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if an error occurs.  A write past end of file
+   extends the inode.  Any gap between the old end of file and
+   OFFSET is left as a hole, which reads as zeros and takes no
+   sectors until it is written. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  off_t old_length;
 
+  rwlock_acquire_write (&inode->rwlock);
+  old_length = inode->data.length;
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      rwlock_release_write (&inode->rwlock);
+      return 0;
+    }
 
   while (size > 0) 
     {
-      /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Block to write, starting byte offset within block. */
+      uint32_t block = offset / BLOCK_SECTOR_SIZE;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Number of bytes to actually write into this sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      /* Copy the chunk into the buffer cache. */
+      if (!write_block (inode, block, buffer + bytes_written, sector_ofs,
+                        chunk_size))
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
-
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
+      if (offset > inode->data.length)
+        inode->data.length = offset;
     }
-  free (bounce);
 
+  if (inode->data.length != old_length || inode->extents_dirty)
+    inode_save (inode);
+  rwlock_release_write (&inode->rwlock);
   return bytes_written;
 }
 
+/* Gives sectors to the delayed blocks of every open inode and
+   writes the inodes to disk. */
+void
+inode_flush (void) 
+{
+  struct hash_iterator i;
+
+  lock_acquire (&open_inodes_lock);
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+      rwlock_acquire_write (&inode->rwlock);
+      allocate_delayed (inode);
+      rwlock_release_write (&inode->rwlock);
+    }
+  lock_release (&open_inodes_lock);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,14 +970,62 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
-inode_length (const struct inode *inode)
+inode_length (struct inode *inode)
+{
+  off_t length;
+
+  rwlock_acquire_read (&inode->rwlock);
+  length = inode->data.length;
+  rwlock_release_read (&inode->rwlock);
+  return length;
+}
+
+/* Acquires directory INODE's directory lock, which the
+   directory code holds while it updates the directory's entries
+   or otherwise needs a consistent view of them. */
+void
+inode_lock_dir (struct inode *inode) 
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases directory INODE's directory lock. */
+void
+inode_unlock_dir (struct inode *inode) 
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Returns true if INODE is a directory, false otherwise. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A precedes inode B. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
 {
-  return inode->data.length;
+  const struct inode *a = hash_entry (a_, struct inode, elem);
+  const struct inode *b = hash_entry (b_, struct inode, elem);
+  return a->sector < b->sector;
 }
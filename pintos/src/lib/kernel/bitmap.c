@@ -27,6 +27,7 @@ typedef unsigned long elem_type;
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
+    size_t next_fit;    /* Where bitmap_scan_and_flip_next() starts. */
     elem_type *bits;    /* Elements that represent bits. */
   };
 
@@ -60,6 +61,31 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Whole elements without such a bit are skipped at once. */
+static size_t
+next_bit (const struct bitmap *b, size_t start, size_t end, bool value) 
+{
+  size_t idx = elem_idx (start);
+  elem_type flip = value ? 0 : (elem_type) -1;
+  elem_type e;
+
+  if (start >= end)
+    return end;
+
+  /* Bits in the first element before START don't count. */
+  e = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (e == 0)
+    {
+      if (++idx >= elem_cnt (end))
+        return end;
+      e = b->bits[idx] ^ flip;
+    }
+  start = idx * ELEM_BITS + __builtin_ctzl (e);
+  return start < end ? start : end;
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -82,6 +108,7 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
+      b->next_fit = 0;
       b->bits = malloc (byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
@@ -104,6 +131,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
   b->bit_cnt = bit_cnt;
+  b->next_fit = 0;
   b->bits = (elem_type *) (b + 1);
   bitmap_set_all (b, false);
   return b;
@@ -251,16 +279,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return next_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -289,6 +312,34 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 
 /* Finding set or unset bits. */
 
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B at or after START and before END that
+   are all set to VALUE.  If there is no such group, returns
+   BITMAP_ERROR.
+
+   Rather than testing every starting index, jumps straight to
+   the next bit set to VALUE, measures the run of such bits that
+   starts there, and if it is too short resumes after it.  Both
+   steps skip whole elements at a time. */
+static size_t
+scan_range (const struct bitmap *b, size_t start, size_t end, size_t cnt,
+            bool value) 
+{
+  while (cnt <= end && start <= end - cnt)
+    {
+      size_t run_end;
+
+      start = next_bit (b, start, end - cnt + 1, value);
+      if (start > end - cnt)
+        break;
+      run_end = next_bit (b, start, start + cnt, !value);
+      if (run_end == start + cnt)
+        return start;
+      start = run_end;
+    }
+  return BITMAP_ERROR;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
@@ -299,15 +350,26 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
-    {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
-    }
-  return BITMAP_ERROR;
+  if (cnt == 0)
+    return start;
+  return scan_range (b, start, b->bit_cnt, cnt, value);
+}
+
+/* Finds and returns the starting index of the first group of CNT
+   consecutive bits in B at or after START that are all set to
+   VALUE and that ends at or before END, looking at no bits
+   outside that range.
+   If there is no such group, returns BITMAP_ERROR. */
+size_t
+bitmap_scan_range (const struct bitmap *b, size_t start, size_t end,
+                   size_t cnt, bool value) 
+{
+  ASSERT (b != NULL);
+  ASSERT (start <= end && end <= b->bit_cnt);
+
+  if (cnt == 0)
+    return start;
+  return scan_range (b, start, end, cnt, value);
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -325,7 +387,38 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
-
+
+/* Like bitmap_scan_and_flip(), but "next fit": the search starts
+   just past the group found by the previous call and wraps
+   around to the beginning of B, instead of always starting
+   from the beginning.  Consecutive allocations therefore do not
+   rescan the same crowded front of B over and over, and tend to
+   land next to each other. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value) 
+{
+  size_t hint, idx;
+
+  ASSERT (b != NULL);
+
+  if (cnt == 0)
+    return 0;
+  hint = b->next_fit < b->bit_cnt ? b->next_fit : 0;
+  idx = scan_range (b, hint, b->bit_cnt, cnt, value);
+  if (idx == BITMAP_ERROR)
+    {
+      /* Wrap around, allowing for a group that straddles HINT. */
+      size_t end = hint + cnt - 1 < b->bit_cnt ? hint + cnt - 1 : b->bit_cnt;
+      idx = scan_range (b, 0, end, cnt, value);
+    }
+  if (idx != BITMAP_ERROR) 
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->next_fit = idx + cnt;
+    }
+  return idx;
+}
+
 /* File input and output. */
 
 #ifdef FILESYS
@@ -359,6 +452,26 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B that holds the CNT bits starting at START
+   to the same place in FILE, leaving the rest of FILE alone.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (b != NULL);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (start + cnt <= b->bit_cnt);
+
+  if (cnt == 0)
+    return true;
+  ofs = elem_idx (start) * sizeof (elem_type);
+  size = (elem_idx (start + cnt - 1) + 1) * sizeof (elem_type) - ofs;
+  return file_write_at (file, (const char *) b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,162 @@
+#include "lz.h"
+#include <debug.h>
+#include <string.h>
+
+/* Compressed data is a sequence of groups, each a control byte
+   followed by up to 8 items.  Bit I of the control byte, counting
+   from the least significant, is 0 if item I is a literal byte
+   copied to the output, 1 if it is a back-reference to data
+   already output.
+
+   A back-reference is 2 bytes.  The top 4 bits of the first byte
+   are a length code and the remaining 12 bits are the distance
+   back to the start of the match, from 1 to 4095.  Length codes
+   0 through 14 mean matches of 3 through 17 bytes.  Code 15 is
+   followed by a third byte, and means 18 plus that byte, so that
+   a long run, such as a page of zeros, takes only a few
+   back-references.  A match may overlap the bytes it produces.
+
+   The compressor finds matches with a hash table, indexed by the
+   next 3 input bytes, of the last position at which they were
+   seen.  Only the most recent candidate is tried. */
+
+#define MIN_MATCH 3                     /* Shortest back-reference. */
+#define LONG_MATCH 18                   /* Shortest 3-byte reference. */
+#define MAX_MATCH (LONG_MATCH + 255)    /* Longest back-reference. */
+#define MAX_DIST 4095                   /* Farthest back-reference. */
+#define HASH_BITS 10                    /* log2 of hash table size. */
+
+/* Returns a hash of the 3 bytes at P. */
+static inline unsigned
+hash3 (const uint8_t *p)
+{
+  uint32_t x = ((uint32_t) p[0] << 16) | (p[1] << 8) | p[2];
+  return (x * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Compresses the SRC_SIZE bytes at SRC, which must be fewer than
+   65536, into the DST_SIZE bytes at DST.  WORK must point to
+   LZ_WORK_SIZE bytes of scratch memory.  Returns the size of the
+   compressed data, or 0 if it would not fit in DST_SIZE bytes. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+             void *dst_, size_t dst_size, void *work)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  uint16_t *table = work;
+  size_t in = 0, out = 0;
+  size_t ctrl = 0;
+  int item = 8;
+
+  ASSERT (src_size <= UINT16_MAX);
+
+  /* Stale entries are harmless: every candidate is checked. */
+  memset (table, 0, LZ_WORK_SIZE);
+
+  while (in < src_size)
+    {
+      size_t len = 0, dist = 0;
+
+      /* Start a new group. */
+      if (item == 8)
+        {
+          if (out >= dst_size)
+            return 0;
+          ctrl = out;
+          dst[out++] = 0;
+          item = 0;
+        }
+
+      /* Look for a match. */
+      if (src_size - in >= MIN_MATCH)
+        {
+          unsigned h = hash3 (src + in);
+          size_t cand = table[h];
+
+          table[h] = in;
+          if (cand < in && in - cand <= MAX_DIST
+              && !memcmp (src + cand, src + in, MIN_MATCH))
+            {
+              size_t max = src_size - in;
+
+              if (max > MAX_MATCH)
+                max = MAX_MATCH;
+
+              len = MIN_MATCH;
+              while (len < max && src[cand + len] == src[in + len])
+                len++;
+              dist = in - cand;
+            }
+        }
+
+      if (len > 0)
+        {
+          unsigned code = len >= LONG_MATCH ? 15 : len - MIN_MATCH;
+
+          if (out + (code == 15 ? 3 : 2) > dst_size)
+            return 0;
+          dst[ctrl] |= 1 << item;
+          dst[out++] = (code << 4) | (dist >> 8);
+          dst[out++] = dist & 0xff;
+          if (code == 15)
+            dst[out++] = len - LONG_MATCH;
+          in += len;
+        }
+      else
+        {
+          if (out >= dst_size)
+            return 0;
+          dst[out++] = src[in++];
+        }
+      item++;
+    }
+  return out;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, produced by
+   lz_compress(), into the DST_SIZE bytes at DST.  Returns the
+   size of the decompressed data, or 0 if SRC is malformed or its
+   decompressed data would not fit in DST_SIZE bytes. */
+size_t
+lz_decompress (const void *src_, size_t src_size, void *dst_, size_t dst_size)
+{
+  const uint8_t *src = src_;
+  uint8_t *dst = dst_;
+  size_t in = 0, out = 0;
+
+  while (in < src_size)
+    {
+      uint8_t ctrl = src[in++];
+      int item;
+
+      for (item = 0; item < 8 && in < src_size; item++)
+        if (ctrl & (1 << item))
+          {
+            size_t len, dist;
+
+            if (src_size - in < 2)
+              return 0;
+            len = (src[in] >> 4) + MIN_MATCH;
+            dist = ((src[in] & 0x0f) << 8) | src[in + 1];
+            in += 2;
+            if (len == 15 + MIN_MATCH)
+              {
+                if (in >= src_size)
+                  return 0;
+                len = LONG_MATCH + src[in++];
+              }
+            if (dist == 0 || dist > out || dst_size - out < len)
+              return 0;
+            for (; len > 0; len--, out++)
+              dst[out] = dst[out - dist];
+          }
+        else
+          {
+            if (out >= dst_size)
+              return 0;
+            dst[out++] = src[in++];
+          }
+    }
+  return out;
+}
@@ -0,0 +1,19 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Small LZ77 compressor, for data that is cheap to compress in
+   memory: zero-filled and repetitive pages.  It favors speed and
+   simplicity over compression ratio. */
+
+/* Bytes of scratch memory that lz_compress() needs. */
+#define LZ_WORK_SIZE (1024 * sizeof (uint16_t))
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size, void *work);
+size_t lz_decompress (const void *src, size_t src_size,
+                      void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
@@ -0,0 +1,155 @@
+/* Benchmark and test program for lib/kernel/bitmap.c.
+
+   Fills a 64 K-bit bitmap with a fragmented pattern of short
+   free runs between longer allocated ones, then times
+   bitmap_scan() against a straightforward bit-by-bit scan, and
+   first-fit allocation against next-fit allocation, checking
+   that the results agree.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Number of bits in the bitmap. */
+#define BIT_CNT 65536
+
+/* Number of scans timed for each run length. */
+#define SCAN_CNT 64
+
+static void fragment (struct bitmap *);
+static size_t slow_scan (const struct bitmap *, size_t start, size_t cnt);
+static void time_scans (struct bitmap *, size_t cnt);
+static void time_allocs (struct bitmap *, bool next_fit);
+
+/* Benchmarks the bitmap implementation. */
+void
+test (void)
+{
+  static const size_t cnts[] = {1, 4, 16, 64};
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  size_t i;
+
+  ASSERT (b != NULL);
+  random_init (0);
+  fragment (b);
+  printf ("%zu of %d bits free\n",
+          bitmap_count (b, 0, BIT_CNT, false), BIT_CNT);
+
+  for (i = 0; i < sizeof cnts / sizeof *cnts; i++)
+    time_scans (b, cnts[i]);
+  time_allocs (b, false);
+  time_allocs (b, true);
+
+  bitmap_destroy (b);
+  printf ("bitmap benchmark done\n");
+}
+
+/* Marks B's bits as alternating runs of 8 to 71 set bits and 1
+   to 16 clear bits, with a longer clear run now and then. */
+static void
+fragment (struct bitmap *b)
+{
+  size_t idx = 0;
+
+  bitmap_set_all (b, true);
+  while (idx < BIT_CNT)
+    {
+      size_t used = 8 + random_ulong () % 64;
+      size_t clear = 1 + random_ulong () % 16;
+
+      if (random_ulong () % 32 == 0)
+        clear *= 8;
+      idx += used;
+      if (idx + clear > BIT_CNT)
+        break;
+      bitmap_set_multiple (b, idx, clear, false);
+      idx += clear;
+    }
+}
+
+/* Returns the index of the first run of CNT clear bits in B at
+   or after START, testing one bit at a time, or BITMAP_ERROR if
+   there is none. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt)
+{
+  size_t i, j;
+
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j))
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* Times SCAN_CNT scans of B for CNT clear bits, from random
+   starting points, with bitmap_scan() and with slow_scan(), and
+   checks that they agree. */
+static void
+time_scans (struct bitmap *b, size_t cnt)
+{
+  size_t starts[SCAN_CNT];
+  size_t found[SCAN_CNT];
+  int64_t fast, slow;
+  size_t i;
+
+  for (i = 0; i < SCAN_CNT; i++)
+    starts[i] = random_ulong () % BIT_CNT;
+
+  fast = timer_ticks ();
+  for (i = 0; i < SCAN_CNT; i++)
+    found[i] = bitmap_scan (b, starts[i], cnt, false);
+  fast = timer_elapsed (fast);
+
+  slow = timer_ticks ();
+  for (i = 0; i < SCAN_CNT; i++)
+    ASSERT (slow_scan (b, starts[i], cnt) == found[i]);
+  slow = timer_elapsed (slow);
+
+  printf ("scan for %3zu: %lld ticks, bit by bit %lld ticks\n",
+          cnt, fast, slow);
+}
+
+/* Times allocating 8-bit runs from a copy of B until it is
+   full, first fit or next fit according to NEXT_FIT. */
+static void
+time_allocs (struct bitmap *b, bool next_fit)
+{
+  struct bitmap *copy = bitmap_create (BIT_CNT);
+  size_t alloc_cnt = 0;
+  int64_t start;
+  size_t i;
+
+  ASSERT (copy != NULL);
+  for (i = 0; i < BIT_CNT; i++)
+    bitmap_set (copy, i, bitmap_test (b, i));
+
+  start = timer_ticks ();
+  for (;;)
+    {
+      size_t idx = (next_fit
+                    ? bitmap_scan_and_flip_next (copy, 8, false)
+                    : bitmap_scan_and_flip (copy, 0, 8, false));
+      if (idx == BITMAP_ERROR)
+        break;
+      alloc_cnt++;
+    }
+  printf ("%s: %zu allocations in %lld ticks\n",
+          next_fit ? "next fit" : "first fit", alloc_cnt,
+          timer_elapsed (start));
+
+  ASSERT (bitmap_scan (copy, 0, 8, false) == BITMAP_ERROR);
+  bitmap_destroy (copy);
+}
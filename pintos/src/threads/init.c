@@ -37,6 +37,11 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -62,6 +67,9 @@ static void paging_init (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
+#ifdef VM
+static size_t parse_count (const char *name, const char *value);
+#endif
 static void run_actions (char **argv);
 static void usage (void);
 
@@ -98,6 +106,10 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
+#ifdef VM
+  frame_init ();
+  page_init ();
+#endif
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -126,6 +138,9 @@ main (void)
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init ();
+#endif
 
   printf ("Boot complete.\n");
   
@@ -259,6 +274,14 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-fa"))
+        page_fault_around = atoi (value) > 1 ? atoi (value) : 1;
+      else if (!strcmp (name, "-rss"))
+        page_rss_limit = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        swap_zcache_pages = parse_count (name, value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -277,6 +300,31 @@ parse_options (char **argv)
   return argv;
 }
 
+#ifdef VM
+/* Parses VALUE, the argument to option NAME, as a non-negative
+   decimal count.  Panics if VALUE is missing, has anything but
+   digits in it, or does not fit in a size_t. */
+static size_t
+parse_count (const char *name, const char *value)
+{
+  const char *cp;
+  size_t cnt = 0;
+
+  if (value == NULL || *value == '\0')
+    PANIC ("option `%s' requires a count (use -h for help)", name);
+  for (cp = value; *cp != '\0'; cp++)
+    {
+      if (*cp < '0' || *cp > '9')
+        PANIC ("option `%s': `%s' is not a non-negative count "
+               "(use -h for help)", name, value);
+      if (cnt > (SIZE_MAX - (*cp - '0')) / 10)
+        PANIC ("option `%s': count `%s' too large", name, value);
+      cnt = cnt * 10 + (*cp - '0');
+    }
+  return cnt;
+}
+#endif
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv)
@@ -315,6 +363,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"open-bench", 2, fsutil_open_bench},
 #endif
       {NULL, 0, NULL},
     };
@@ -361,6 +410,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  open-bench COUNT   Time opening and closing COUNT files.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -381,6 +431,11 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -fa=COUNT          Map up to COUNT pages per page fault.\n"
+          "  -rss=COUNT         Limit each process to COUNT resident pages.\n"
+          "  -zswap=COUNT       Keep up to COUNT pages of compressed swap in RAM.\n"
 #endif
           );
   shutdown_power_off ();
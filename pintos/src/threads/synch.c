@@ -336,3 +336,105 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes readers-writer lock RWLOCK.  Any number of
+   threads may hold RWLOCK for reading at once, or a single
+   thread may hold it for writing.  A thread that is waiting to
+   write keeps new readers out, so that a steady stream of
+   readers cannot starve writers.  Like a lock, a readers-writer
+   lock is not recursive: a thread must not try to acquire one
+   it already holds, for reading or writing. */
+void
+rwlock_init (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+
+  lock_init (&rwlock->lock);
+  cond_init (&rwlock->read_cond);
+  cond_init (&rwlock->write_cond);
+  rwlock->readers = 0;
+  rwlock->waiting_writers = 0;
+  rwlock->writer = NULL;
+}
+
+/* Acquires RWLOCK for reading, sleeping until no thread holds
+   it for writing or is waiting to.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rwlock->lock);
+  while (rwlock->writer != NULL || rwlock->waiting_writers > 0)
+    cond_wait (&rwlock->read_cond, &rwlock->lock);
+  rwlock->readers++;
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   reading. */
+void
+rwlock_release_read (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+
+  lock_acquire (&rwlock->lock);
+  ASSERT (rwlock->readers > 0);
+  if (--rwlock->readers == 0)
+    cond_signal (&rwlock->write_cond, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Acquires RWLOCK for writing, sleeping until no other thread
+   holds it at all.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->waiting_writers++;
+  while (rwlock->writer != NULL || rwlock->readers > 0)
+    cond_wait (&rwlock->write_cond, &rwlock->lock);
+  rwlock->waiting_writers--;
+  rwlock->writer = thread_current ();
+  lock_release (&rwlock->lock);
+}
+
+/* Releases RWLOCK, which the current thread must hold for
+   writing.  Hands it to the next waiting writer, if any, and
+   otherwise lets in all the waiting readers. */
+void
+rwlock_release_write (struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+  ASSERT (rwlock_held_for_write (rwlock));
+
+  lock_acquire (&rwlock->lock);
+  rwlock->writer = NULL;
+  if (rwlock->waiting_writers > 0)
+    cond_signal (&rwlock->write_cond, &rwlock->lock);
+  else
+    cond_broadcast (&rwlock->read_cond, &rwlock->lock);
+  lock_release (&rwlock->lock);
+}
+
+/* Returns true if the current thread holds RWLOCK for writing,
+   false otherwise.  (Note that testing whether some other thread
+   holds a lock would be racy.) */
+bool
+rwlock_held_for_write (const struct rwlock *rwlock) 
+{
+  ASSERT (rwlock != NULL);
+
+  return rwlock->writer == thread_current ();
+}
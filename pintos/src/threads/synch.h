@@ -46,6 +46,24 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock 
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition read_cond; /* Signaled when readers may enter. */
+    struct condition write_cond; /* Signaled when a writer may enter. */
+    unsigned readers;           /* Number of readers holding the lock. */
+    unsigned waiting_writers;   /* Number of writers waiting. */
+    struct thread *writer;      /* Writer holding the lock, if any. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
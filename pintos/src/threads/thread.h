@@ -4,6 +4,11 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#ifdef VM
+#include <hash.h>
+#endif
+
+struct dir;
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -96,6 +101,25 @@ struct thread
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct file *exec_file;             /* Executable, denied writes. */
+#endif
+
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash pages;                  /* Supplemental page table. */
+    bool has_pages;                     /* PAGES initialized? */
+    long long fault_cnt;                /* Page faults resolved. */
+    long long fault_around_cnt;         /* Pages mapped by fault-around. */
+    struct list_elem page_elem;         /* Element in page.c's process list. */
+    size_t rss;                         /* Resident pages. */
+    size_t rss_limit;                   /* Resident page limit, 0=none. */
+    size_t ws;                          /* Working set estimate, in pages. */
+    int64_t ws_sample;                  /* Time of last working set sample. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c. */
+    struct dir *cwd;                    /* Working directory, null=root. */
 #endif
 
     //stuff for part 2
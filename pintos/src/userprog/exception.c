@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -65,6 +69,9 @@ void
 exception_print_stats (void) 
 {
   printf ("Exception: %lld page faults\n", page_fault_cnt);
+#ifdef VM
+  page_print_stats ();
+#endif
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -148,6 +155,27 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Bring in a page that has not been loaded yet, or give the
+     process its own copy of a page that fork() left shared
+     copy-on-write, and retry the access.  The kernel takes these
+     faults too, when it touches user memory on behalf of a
+     system call. */
+  if (page_handle_fault (fault_addr, not_present, write))
+    return;
+#endif
+
+  /* A bad user address passed to a system call.  get_user() and
+     put_user() in syscall.c put the address to resume at in eax
+     before they touch user memory; resume there with eax set to
+     0, which they return as failure. */
+  if (!user && is_user_vaddr (fault_addr))
+    {
+      f->eip = (void (*) (void)) f->eax;
+      f->eax = 0;
+      return;
+    }
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
@@ -5,6 +5,9 @@
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
@@ -23,7 +26,9 @@ pagedir_create (void)
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  With VM, user pages are released through the
+   frame table, so frames still mapped by other processes
+   survive. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -41,7 +46,11 @@ pagedir_destroy (uint32_t *pd)
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
           if (*pte & PTE_P) 
+#ifdef VM
+            frame_free (pte_get_page (*pte));
+#else
             palloc_free_page (pte_get_page (*pte));
+#endif
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
@@ -214,6 +223,84 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
     }
 }
 
+/* Returns true if virtual page UPAGE in PD is mapped
+   copy-on-write, that is, shared read-only with another process
+   by pagedir_fork() although the process may write it. */
+bool
+pagedir_is_cow (uint32_t *pd, const void *upage) 
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_COW)) == (PTE_P | PTE_COW);
+}
+
+/* Makes the present page UPAGE in PD read-only and
+   copy-on-write, so that the first write to it faults and is
+   given a private copy. */
+void
+pagedir_set_cow (uint32_t *pd, const void *upage) 
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+  ASSERT (pte != NULL && (*pte & PTE_P) != 0);
+  *pte = (*pte & ~(uint32_t) PTE_W) | PTE_COW;
+  invalidate_pagedir (pd);
+}
+
+/* Copies the user mappings in page directory SRC into DST, which
+   must not have any yet, for fork().
+
+   With VM the two page directories share every frame.  Pages
+   that are writable in SRC become read-only and copy-on-write in
+   both, so that the first write by either process faults and
+   takes a private copy (see frame_copy_on_write()).  Without VM,
+   each page is copied immediately.
+
+   Returns true if successful, false if memory allocation fails,
+   in which case DST holds only some of the mappings and should
+   be destroyed. */
+bool
+pagedir_fork (uint32_t *dst, uint32_t *src) 
+{
+  uint32_t *pde;
+
+  ASSERT (dst != init_page_dir);
+
+  for (pde = src; pde < src + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P) 
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        size_t i;
+
+        for (i = 0; i < PGSIZE / sizeof *pt; i++)
+          {
+            void *upage = (void *) (((pde - src) << PDSHIFT) | (i << PTSHIFT));
+            uint32_t *pte = &pt[i];
+            uint32_t *dst_pte;
+
+            if ((*pte & PTE_P) == 0)
+              continue;
+            dst_pte = lookup_page (dst, upage, true);
+            if (dst_pte == NULL)
+              return false;
+#ifdef VM
+            if (*pte & PTE_W)
+              *pte = (*pte & ~(uint32_t) PTE_W) | PTE_COW;
+            frame_ref (pte_get_page (*pte));
+            *dst_pte = *pte;
+#else
+            {
+              void *kpage = palloc_get_page (PAL_USER);
+              if (kpage == NULL)
+                return false;
+              memcpy (kpage, pte_get_page (*pte), PGSIZE);
+              *dst_pte = pte_create_user (kpage, (*pte & PTE_W) != 0);
+            }
+#endif
+          }
+      }
+  invalidate_pagedir (src);
+  return true;
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
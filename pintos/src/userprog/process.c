@@ -19,8 +19,12 @@
 #include "threads/vaddr.h"
 #include "userprog/syscall.h"
 #include "threads/malloc.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
+static thread_func fork_child NO_RETURN;
 static bool load (const char *cmdline,void (**eip) (void), void ** esp, char ** tokr_pntr);
 //static void * push (uint8_t *kpage, size_t *offset, const void *buf, size_t size);
 //static bool setup_stack_helper (const char * cmd_line, uint8_t * kpage, uint8_t * upage, void ** esp);
@@ -98,6 +102,82 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Passed from process_fork() to the new child, fork_child(). */
+struct fork_info
+  {
+    struct thread *parent;              /* Process being cloned. */
+    struct intr_frame if_;              /* Parent's user registers. */
+    struct semaphore done;              /* Up'd once child is set up. */
+    bool success;                       /* Did the child set up OK? */
+  };
+
+/* Clones the current process, whose user register state at the
+   system call is F.  The child gets a copy of the parent's
+   address space and open files and resumes from the same system
+   call, where it sees a return value of 0.  Returns the child's
+   thread id to the parent, or TID_ERROR if the child could not
+   be created.
+
+   With VM the address space is not copied up front: parent and
+   child share every frame copy-on-write (see pagedir_fork()), so
+   a pre-forked worker pays only for the pages it modifies. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct fork_info info;
+  tid_t tid;
+
+  info.parent = thread_current ();
+  info.if_ = *f;
+  sema_init (&info.done, 0);
+  info.success = false;
+
+  tid = thread_create (thread_name (), PRI_DEFAULT, fork_child, &info);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+  sema_down (&info.done);
+  return info.success ? tid : TID_ERROR;
+}
+
+/* A thread function that sets up a child process cloned from
+   the parent described by INFO_ and starts it running. */
+static void
+fork_child (void *info_)
+{
+  struct fork_info *info = info_;
+  struct thread *parent = info->parent;
+  struct thread *t = thread_current ();
+  struct intr_frame if_;
+  bool success;
+
+  if_ = info->if_;
+  if_.eax = 0;
+
+  t->exec_file = file_reopen (parent->exec_file);
+  if (t->exec_file != NULL)
+    file_deny_write (t->exec_file);
+  t->pagedir = pagedir_create ();
+  success = (t->pagedir != NULL
+#ifdef VM
+             && page_table_copy (t, parent)
+#else
+             && pagedir_fork (t->pagedir, parent->pagedir)
+#endif
+             && t->exec_file != NULL
+             && process_copy_files (t, parent));
+  process_activate ();
+
+  t->cp->load = success ? 1 : -1;
+  info->success = success;
+  sema_up (&info->done);
+  if (!success)
+    thread_exit ();
+
+  /* Return to user mode, as start_process() does. */
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -149,7 +229,11 @@ process_exit (void)
     {
       cur->cp->exit = true;
     }
-  
+
+#ifdef VM
+  page_table_destroy ();
+#endif
+
   if (pd != NULL) 
     {
       /* Correct ordering here is crucial.  We must set
@@ -163,6 +247,11 @@ process_exit (void)
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+
+  /* Allow writes to our executable again, only now that none of
+     its pages are mapped or shared from our frames any more. */
+  file_close (cur->exec_file);
+  cur->exec_file = NULL;
 }
 
 /* Sets up the CPU for running user code in the current
@@ -269,6 +358,10 @@ load (const char *file_name, void (**eip) (void), void ** esp, char ** tokr_pntr
   if (t->pagedir == NULL) 
     goto done;
   process_activate ();
+#ifdef VM
+  if (!page_table_init ())
+    goto done;
+#endif
   
   /* Open executable file. */
   file = filesys_open (file_name);
@@ -360,14 +453,25 @@ load (const char *file_name, void (**eip) (void), void ** esp, char ** tokr_pntr
   success = true;
 
  done:
-  /* We arrive here whether the load is successful or not. */
-  //file close moved to process exit
+  /* We arrive here whether the load is successful or not.
+     On success the executable stays open, with writes denied,
+     until process_exit(): its read-only pages may be shared
+     with other processes and must not change underneath them. */
+  if (success)
+    {
+      file_deny_write (file);
+      t->exec_file = file;
+    }
+  else
+    file_close (file);
   return success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -426,6 +530,10 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With VM, the pages are only entered in the supplemental page
+   table here; each is read in when the process first touches
+   it.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -436,7 +544,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -444,14 +551,22 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
          and zero the final PAGE_ZERO_BYTES bytes. */
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
+#ifdef VM
+      /* Record where the page comes from.  It is read in when the
+         process first touches it; see page_handle_fault(). */
+      if (!(page_read_bytes > 0
+            ? page_add_file (upage, file, ofs, page_read_bytes, writable)
+            : page_add_zero (upage, writable)))
+        return false;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
         return false;
 
       /* Load this page. */
-      if (file_read (file, kpage, page_read_bytes) != (int) page_read_bytes)
+      if (file_read_at (file, kpage, page_read_bytes, ofs)
+          != (int) page_read_bytes)
         {
           palloc_free_page (kpage);
           return false; 
@@ -464,10 +579,12 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
+      ofs += page_read_bytes;
       upage += PGSIZE;
     }
   return true;
@@ -478,9 +595,20 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp,char * file_name, char ** tokr_pntr) 
 {
-  uint8_t *kpage;
   bool success = false;
 
+#ifdef VM
+  /* The stack is an ordinary zero page, loaded right away since
+     we are about to fill it. */
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+  success = page_add_zero (upage, true) && page_load (upage);
+  if (success)
+    *esp = PHYS_BASE;
+  else
+    return success;
+#else
+  uint8_t *kpage;
+
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
   if (kpage != NULL) 
     {
@@ -493,6 +621,7 @@ setup_stack (void **esp,char * file_name, char ** tokr_pntr)
         return success;
 	  }
     }
+#endif
     //success = setup_stack_helper(cmd_ptr, kpage, ((uint8_t *) PHYS_BASE) - PGSIZE, esp);
   char *token;		
   char **argv = malloc(2*sizeof(char *));		
@@ -542,6 +671,7 @@ setup_stack (void **esp,char * file_name, char ** tokr_pntr)
   return success;
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -561,6 +691,7 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
 
 //------------------------------------------------------------------------
 /*
@@ -1,17 +1,19 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "devices/shutdown.h"
+#include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
-
-
-struct lock file_lock;
+#include "filesys/inode.h"
+#include "userprog/process.h"
 
 struct process_file {
   struct file *file;
@@ -25,12 +27,11 @@ void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&file_lock);
 }
 
 static void syscall_handler (struct intr_frame *f UNUSED) 
 {
-  int * callvalue =(int*) f->esp;  //syscall value
+  int callvalue;                   //syscall value
   int args[3];
   int numOfArgs;				   //diff per each syscall
 
@@ -39,8 +40,9 @@ static void syscall_handler (struct intr_frame *f UNUSED)
 	
   //copy_in (args, (uint32_t *) f->esp + 1, sizeof (*args) * numOfArgs);
   
-  check_pointer(callvalue);
-  switch(*callvalue)
+  check_pointer(f->esp);
+  copy_in(&callvalue, f->esp, sizeof callvalue);
+  switch(callvalue)
   {
 	  case SYS_HALT:
 	  {
@@ -59,6 +61,41 @@ static void syscall_handler (struct intr_frame *f UNUSED)
 		 f->eax = write(args[0], (const void *) args[1], (unsigned) args[2]);
 		 break;
 	  }
+	  case SYS_FORK:
+	  {
+		f->eax = process_fork (f);
+		break;
+	  }
+	  case SYS_CHDIR:
+	  {
+		copy_in(args, (uint32_t *) f->esp + 1, sizeof *args * 1);
+		f->eax = chdir((const char *) args[0]);
+		break;
+	  }
+	  case SYS_MKDIR:
+	  {
+		copy_in(args, (uint32_t *) f->esp + 1, sizeof *args * 1);
+		f->eax = mkdir((const char *) args[0]);
+		break;
+	  }
+	  case SYS_READDIR:
+	  {
+		copy_in(args, (uint32_t *) f->esp + 1, sizeof *args * 2);
+		f->eax = readdir(args[0], (char *) args[1]);
+		break;
+	  }
+	  case SYS_ISDIR:
+	  {
+		copy_in(args, (uint32_t *) f->esp + 1, sizeof *args * 1);
+		f->eax = isdir(args[0]);
+		break;
+	  }
+	  case SYS_INUMBER:
+	  {
+		copy_in(args, (uint32_t *) f->esp + 1, sizeof *args * 1);
+		f->eax = inumber(args[0]);
+		break;
+	  }
   }
 };
 
@@ -75,23 +112,111 @@ void exit (int status)
   thread_exit();		
 }
 
+/* Writes SIZE bytes from user BUFFER to FD.  The data is copied
+   into a kernel page first, a page at a time, and written from
+   there.  The file system copies data while it holds the buffer
+   cache lock, and a page fault on a user buffer would need that
+   lock again to page the buffer in. */
 int write (int fd, const void *buffer, unsigned size)
 {
-  if (fd == STDOUT_FILENO)
+  const uint8_t *ubuf = buffer;
+  struct file *f = NULL;
+  uint8_t *kbuf;
+  int written = 0;
+
+  if (fd != STDOUT_FILENO)
     {
-      putbuf(buffer, size);
-      return size;
+      f = process_get_file(fd);
+      if (!f || inode_is_dir(file_get_inode(f)))
+        return -1;
     }
-  lock_acquire(&file_lock);
+
+  kbuf = palloc_get_page(0);
+  if (!kbuf)
+    return -1;
+  while (size > 0)
+    {
+      unsigned chunk = size < PGSIZE ? size : PGSIZE;
+      unsigned done;
+
+      if (!try_copy_in(kbuf, ubuf + written, chunk))
+        {
+          palloc_free_page(kbuf);
+          thread_exit();
+        }
+      if (f)
+        done = file_write(f, kbuf, chunk);
+      else
+        {
+          putbuf((const char *) kbuf, chunk);
+          done = chunk;
+        }
+      written += done;
+      size -= done;
+      if (done < chunk)
+        break;
+    }
+  palloc_free_page(kbuf);
+  return written;
+}
+
+/* Changes the working directory to DIR, a user string, which
+   may be relative to the old one. */
+bool chdir (const char *dir)
+{
+  char *kdir = copy_in_string(dir);
+  bool success = filesys_chdir(kdir);
+  palloc_free_page(kdir);
+  return success;
+}
+
+/* Creates directory DIR, a user string. */
+bool mkdir (const char *dir)
+{
+  char *kdir = copy_in_string(dir);
+  bool success = filesys_mkdir(kdir);
+  palloc_free_page(kdir);
+  return success;
+}
+
+/* Reads the next entry from directory FD into user buffer NAME,
+   which must have room for NAME_MAX + 1 bytes.  The file's
+   position serves as the directory's. */
+bool readdir (int fd, char *name)
+{
+  char kname[NAME_MAX + 1];
+  bool success = false;
+
   struct file *f = process_get_file(fd);
-  if (!f)
+  if (f && inode_is_dir(file_get_inode(f)))
     {
-      lock_release(&file_lock);
-      return -1;
+      struct dir *dir = dir_open(inode_reopen(file_get_inode(f)));
+      if (dir)
+        {
+          dir_seek(dir, file_tell(f));
+          success = dir_readdir(dir, kname);
+          file_seek(f, dir_tell(dir));
+          dir_close(dir);
+        }
     }
-  int bytes = file_write(f, buffer, size);
-  lock_release(&file_lock);
-  return bytes;
+  if (success)
+    copy_out(name, kname, strlen(kname) + 1);
+  return success;
+}
+
+/* Returns true if FD is open on a directory. */
+bool isdir (int fd)
+{
+  struct file *f = process_get_file(fd);
+  return f && inode_is_dir(file_get_inode(f));
+}
+
+/* Returns the inode number of the file or directory FD is open
+   on, or -1 if FD is not open. */
+int inumber (int fd)
+{
+  struct file *f = process_get_file(fd);
+  return f ? (int) inode_get_inumber(file_get_inode(f)) : -1;
 }
 
 
@@ -110,14 +235,80 @@ void check_pointer (const void *pointer)
    Call thread_exit() if any of the user accesses are invalid. */
 void
 copy_in (void *dst_, const void *usrc_, size_t size) 
+{
+  if (!try_copy_in (dst_, usrc_, size))
+    thread_exit ();
+};
+
+/* Copies SIZE bytes from user address USRC to kernel address
+   DST.
+   Returns true if successful, false if any of the user accesses
+   are invalid. */
+bool
+try_copy_in (void *dst_, const void *usrc_, size_t size) 
 {
   uint8_t *dst = dst_;
   const uint8_t *usrc = usrc_;
  
   for (; size > 0; size--, dst++, usrc++) 
     if (usrc >= (uint8_t *) PHYS_BASE || !get_user (dst, usrc)) 
+      return false;
+  return true;
+}
+
+/* Writes BYTE to user address UDST.
+   UDST must be below PHYS_BASE.
+   Returns true if successful, false if a segfault occurred. */
+static inline bool
+put_user (uint8_t *udst, uint8_t byte)
+{
+  int eax;
+  asm ("movl $1f, %%eax; movb %b2, %0; 1:"
+       : "=m" (*udst), "=&a" (eax) : "q" (byte));
+  return eax != 0;
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address
+   UDST.
+   Call thread_exit() if any of the user accesses are invalid. */
+void
+copy_out (void *udst_, const void *src_, size_t size) 
+{
+  uint8_t *udst = udst_;
+  const uint8_t *src = src_;
+
+  for (; size > 0; size--, udst++, src++) 
+    if (udst >= (uint8_t *) PHYS_BASE || !put_user (udst, *src)) 
       thread_exit ();
-};
+}
+
+/* Creates a copy of user string US in kernel memory and returns
+   it as a page that must be freed with palloc_free_page().
+   Truncates the string at PGSIZE bytes in size.
+   Call thread_exit() if any of the user accesses are invalid. */
+char *
+copy_in_string (const char *us) 
+{
+  char *ks = palloc_get_page (0);
+  size_t length;
+
+  if (ks == NULL) 
+    thread_exit ();
+  for (length = 0; length < PGSIZE; length++)
+    {
+      if ((const uint8_t *) us + length >= (uint8_t *) PHYS_BASE
+          || !get_user ((uint8_t *) ks + length,
+                        (const uint8_t *) us + length)) 
+        {
+          palloc_free_page (ks);
+          thread_exit (); 
+        }
+      if (ks[length] == '\0')
+        return ks;
+    }
+  ks[PGSIZE - 1] = '\0';
+  return ks;
+}
 
 /* Copies a byte from user address USRC to kernel address DST.
    USRC must be below PHYS_BASE.
@@ -148,6 +339,33 @@ struct file* process_get_file (int fd)
   return NULL;
 }
 
+/* Gives thread DST its own copy of each of SRC's open files, with
+   the same descriptors and positions, for fork().  Returns true
+   if successful, false if memory allocation fails. */
+bool process_copy_files (struct thread *dst, struct thread *src)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&src->files); e != list_end (&src->files);
+       e = list_next (e))
+    {
+      struct process_file *pf = list_entry (e, struct process_file, elem);
+      struct process_file *copy = malloc(sizeof *copy);
+      if (!copy)
+        return false;
+      copy->file = file_reopen(pf->file);
+      if (!copy->file)
+        {
+          free(copy);
+          return false;
+        }
+      file_seek(copy->file, file_tell(pf->file));
+      copy->fd = pf->fd;
+      list_push_back(&dst->files, &copy->elem);
+    }
+  dst->fd = src->fd;
+  return true;
+}
 
 /*get's child process struct by looping through the current thread's 
  and returns the cp in which the child proccesses match. 
@@ -1,6 +1,7 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 #define USER_DATA_BOTTOM ((void *) 0x08048000)
 
@@ -21,14 +22,23 @@ void syscall_init (void);
 void exit (int status);
 void halt (void);
 int write (int fd, const void *buffer, unsigned size);
+bool chdir (const char *dir);
+bool mkdir (const char *dir);
+bool readdir (int fd, char *name);
+bool isdir (int fd);
+int inumber (int fd);
 
 void check_pointer (const void *pointer);
 
 void copy_in (void *dst_, const void *usrc_, size_t size);
+bool try_copy_in (void *dst_, const void *usrc_, size_t size);
+void copy_out (void *udst_, const void *src_, size_t size);
+char *copy_in_string (const char *us);
 
 inline bool get_user (uint8_t *dst, const uint8_t *usrc);
 
 struct file* process_get_file (int fd);
+bool process_copy_files (struct thread *dst, struct thread *src);
 
 struct child_process* get_child (int pid);
 struct child_process* child_proc (int pid);
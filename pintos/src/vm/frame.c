@@ -0,0 +1,414 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Frame table.
+
+   Every page obtained from the user pool for a user process is
+   recorded here, so that a single physical frame can be mapped
+   into more than one address space.  Each frame carries a
+   reference count of the page table entries that point to it;
+   the page is returned to the user pool only when the last
+   mapping goes away.
+
+   fork() shares all of a process's frames with its child, marking
+   writable pages copy-on-write in both page directories.  The
+   first write to such a page is resolved by
+   frame_copy_on_write(), which copies the frame unless the
+   writer turns out to be its last user.
+
+   Read-only pages loaded from executables are additionally
+   entered in the share table, keyed by the inode, offset, and
+   length of the file data they hold.  A later exec of the same
+   executable finds them there and maps the existing frame
+   instead of reading the file again.
+
+   One frame of zeros is shared by every page of anonymous or BSS
+   memory that has been read but never written.  The frame table
+   itself holds a reference to it, so it is never freed and never
+   reclaimed in place by frame_copy_on_write(): the first write to
+   the page always moves it to a private frame. */
+
+/* A physical frame holding a user page. */
+struct frame
+  {
+    struct hash_elem hash_elem;         /* Element in frame_table. */
+    void *kpage;                        /* Kernel virtual address. */
+    int ref_cnt;                        /* Number of mappings. */
+
+    /* Read-only file data shared between processes. */
+    bool shared;                        /* In share_table? */
+    struct hash_elem share_elem;        /* Element in share_table. */
+    block_sector_t inode_sector;        /* Inode of the backing file. */
+    off_t ofs;                          /* Offset of the page in the file. */
+    size_t read_bytes;                  /* Bytes read; the rest is zeroed. */
+  };
+
+static struct hash frame_table;         /* All frames, keyed by kpage. */
+static struct hash share_table;         /* Shared frames, keyed by file data. */
+static struct lock frame_lock;          /* Protects both tables. */
+static void *zero_kpage;                /* The shared page of zeros. */
+
+/* Statistics. */
+static long long share_hit_cnt;         /* Shared pages found in memory. */
+static long long share_miss_cnt;        /* Shared pages read from disk. */
+static long long cow_copy_cnt;          /* Copy-on-write pages copied. */
+static long long cow_reuse_cnt;         /* Copy-on-write pages reclaimed. */
+static long long zero_map_cnt;          /* Mappings of the zero page. */
+static long long zero_copy_cnt;         /* Zero page mappings written. */
+
+static hash_hash_func frame_hash, share_hash;
+static hash_less_func frame_less, share_less;
+static struct frame *frame_lookup (void *kpage);
+static struct frame *share_lookup (struct file *, off_t ofs,
+                                   size_t read_bytes);
+
+/* Initializes the frame table. */
+void
+frame_init (void)
+{
+  hash_init (&frame_table, frame_hash, frame_less, NULL);
+  hash_init (&share_table, share_hash, share_less, NULL);
+  lock_init (&frame_lock);
+
+  zero_kpage = frame_alloc (PAL_ZERO);
+  if (zero_kpage == NULL)
+    PANIC ("no memory for the zero page");
+}
+
+/* Obtains a page from the user pool, as palloc_get_page() with
+   PAL_USER added to FLAGS, and enters it in the frame table with
+   a single reference.  If the pool is empty, evicts user pages
+   to make room (see page_evict()).  Returns the page's kernel
+   virtual address, or a null pointer if no memory is
+   available. */
+void *
+frame_alloc (enum palloc_flags flags)
+{
+  struct frame *f = malloc (sizeof *f);
+  if (f == NULL)
+    return NULL;
+
+  f->kpage = palloc_get_page (PAL_USER | flags);
+  while (f->kpage == NULL && page_evict ())
+    f->kpage = palloc_get_page (PAL_USER | flags);
+  if (f->kpage == NULL)
+    {
+      free (f);
+      return NULL;
+    }
+  f->ref_cnt = 1;
+  f->shared = false;
+
+  lock_acquire (&frame_lock);
+  hash_insert (&frame_table, &f->hash_elem);
+  lock_release (&frame_lock);
+
+  return f->kpage;
+}
+
+/* Drops one reference to the frame at KPAGE.  When the last
+   reference is dropped the frame leaves the frame table (and the
+   share table, if it was shared) and its page is freed. */
+void
+frame_free (void *kpage)
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = frame_lookup (kpage);
+  ASSERT (f != NULL);
+  ASSERT (f->ref_cnt > 0);
+  if (--f->ref_cnt > 0)
+    {
+      lock_release (&frame_lock);
+      return;
+    }
+  hash_delete (&frame_table, &f->hash_elem);
+  if (f->shared)
+    hash_delete (&share_table, &f->share_elem);
+  lock_release (&frame_lock);
+
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/* Adds a reference to the frame at KPAGE, for mapping it into
+   another page directory. */
+void
+frame_ref (void *kpage)
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = frame_lookup (kpage);
+  ASSERT (f != NULL);
+  f->ref_cnt++;
+  lock_release (&frame_lock);
+}
+
+/* Returns true if the frame at KPAGE has more than one mapping,
+   so that unmapping it in one address space would not free it. */
+bool
+frame_is_shared (void *kpage)
+{
+  struct frame *f;
+  bool shared;
+
+  lock_acquire (&frame_lock);
+  f = frame_lookup (kpage);
+  ASSERT (f != NULL);
+  shared = f->ref_cnt > 1;
+  lock_release (&frame_lock);
+  return shared;
+}
+
+/* Returns the shared page of zeros, with a new reference to be
+   dropped with frame_free().  The page must only be mapped
+   read-only, or copy-on-write with pagedir_set_cow(). */
+void *
+frame_zero_page (void)
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = frame_lookup (zero_kpage);
+  f->ref_cnt++;
+  zero_map_cnt++;
+  lock_release (&frame_lock);
+  return zero_kpage;
+}
+
+/* Resolves a write fault on user virtual page UPAGE in page
+   directory PD.  If UPAGE is mapped copy-on-write, remaps it
+   writable to a frame of its own, copying the data unless no
+   other mapping of the old frame remains, and returns true.
+   Returns false if UPAGE is not copy-on-write or if memory is
+   exhausted. */
+bool
+frame_copy_on_write (uint32_t *pd, void *upage)
+{
+  struct frame *f;
+  void *kpage, *copy;
+
+  ASSERT (pg_ofs (upage) == 0);
+
+  if (pd == NULL || !pagedir_is_cow (pd, upage))
+    return false;
+  kpage = pagedir_get_page (pd, upage);
+
+  /* Nobody else can gain a reference to a private frame while we
+     hold its only one, so the frame can be reclaimed in place
+     once the other processes have let go of it. */
+  lock_acquire (&frame_lock);
+  f = frame_lookup (kpage);
+  ASSERT (f != NULL);
+  if (f->ref_cnt == 1 && !f->shared)
+    {
+      cow_reuse_cnt++;
+      lock_release (&frame_lock);
+      copy = kpage;
+    }
+  else if (kpage == zero_kpage)
+    {
+      lock_release (&frame_lock);
+      copy = frame_alloc (PAL_ZERO);
+      if (copy == NULL)
+        return false;
+      zero_copy_cnt++;
+    }
+  else
+    {
+      lock_release (&frame_lock);
+      copy = frame_alloc (0);
+      if (copy == NULL)
+        return false;
+      memcpy (copy, kpage, PGSIZE);
+      cow_copy_cnt++;
+    }
+
+  pagedir_clear_page (pd, upage);
+  if (!pagedir_set_page (pd, upage, copy, true))
+    NOT_REACHED ();
+  if (copy != kpage)
+    frame_free (kpage);
+  return true;
+}
+
+/* Returns a frame holding READ_BYTES bytes of FILE starting at
+   offset OFS, followed by zeros to the end of the page, for
+   mapping read-only into the current process.  If another
+   process already has the same data in memory, that frame is
+   reused without any disk I/O; otherwise a new frame is read
+   from FILE and made available to later callers.  Either way the
+   caller owns one reference, to be dropped with frame_free().
+   Returns a null pointer if memory is exhausted or the read
+   fails. */
+void *
+frame_get_shared (struct file *file, off_t ofs, size_t read_bytes)
+{
+  struct frame *f;
+  void *kpage;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  kpage = frame_find_shared (file, ofs, read_bytes);
+  if (kpage != NULL)
+    return kpage;
+
+  /* Not in memory: read it into a fresh frame.  The frame lock
+     is not held across the read, so another process may race us
+     to the same page; whoever enters the share table first
+     wins. */
+  kpage = frame_alloc (0);
+  if (kpage == NULL)
+    return NULL;
+  if (file_read_at (file, kpage, read_bytes, ofs) != (off_t) read_bytes)
+    {
+      frame_free (kpage);
+      return NULL;
+    }
+  memset ((uint8_t *) kpage + read_bytes, 0, PGSIZE - read_bytes);
+
+  lock_acquire (&frame_lock);
+  f = share_lookup (file, ofs, read_bytes);
+  if (f != NULL)
+    {
+      /* Lost the race.  Use the winner's frame instead. */
+      f->ref_cnt++;
+      share_hit_cnt++;
+      lock_release (&frame_lock);
+      frame_free (kpage);
+      return f->kpage;
+    }
+
+  f = frame_lookup (kpage);
+  f->shared = true;
+  f->inode_sector = inode_get_inumber (file_get_inode (file));
+  f->ofs = ofs;
+  f->read_bytes = read_bytes;
+  hash_insert (&share_table, &f->share_elem);
+  share_miss_cnt++;
+  lock_release (&frame_lock);
+
+  return kpage;
+}
+
+/* Like frame_get_shared(), but never reads the file: returns a
+   null pointer unless another process already has the data in
+   memory. */
+void *
+frame_find_shared (struct file *file, off_t ofs, size_t read_bytes)
+{
+  struct frame *f;
+  void *kpage = NULL;
+
+  lock_acquire (&frame_lock);
+  f = share_lookup (file, ofs, read_bytes);
+  if (f != NULL)
+    {
+      f->ref_cnt++;
+      share_hit_cnt++;
+      kpage = f->kpage;
+    }
+  lock_release (&frame_lock);
+  return kpage;
+}
+
+/* Prints frame table statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %lld shared pages reused, %lld read from disk\n",
+          share_hit_cnt, share_miss_cnt);
+  printf ("Frames: %lld copy-on-write pages copied, %lld reclaimed\n",
+          cow_copy_cnt, cow_reuse_cnt);
+  printf ("Frames: %lld zero page mappings, %lld made private\n",
+          zero_map_cnt, zero_copy_cnt);
+}
+
+/* Returns the frame for KPAGE, which must be in the frame
+   table.  The frame lock must be held. */
+static struct frame *
+frame_lookup (void *kpage)
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  key.kpage = kpage;
+  e = hash_find (&frame_table, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct frame, hash_elem) : NULL;
+}
+
+/* Returns the shared frame holding READ_BYTES bytes of FILE at
+   offset OFS, or a null pointer if there is none.  The frame
+   lock must be held. */
+static struct frame *
+share_lookup (struct file *file, off_t ofs, size_t read_bytes)
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  key.inode_sector = inode_get_inumber (file_get_inode (file));
+  key.ofs = ofs;
+  key.read_bytes = read_bytes;
+  e = hash_find (&share_table, &key.share_elem);
+  return e != NULL ? hash_entry (e, struct frame, share_elem) : NULL;
+}
+
+/* Returns a hash value for frame E. */
+static unsigned
+frame_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, hash_elem);
+  return hash_bytes (&f->kpage, sizeof f->kpage);
+}
+
+/* Returns true if frame A precedes frame B. */
+static bool
+frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, hash_elem);
+  const struct frame *b = hash_entry (b_, struct frame, hash_elem);
+  return a->kpage < b->kpage;
+}
+
+/* Returns a hash value for the file data held by shared frame
+   E. */
+static unsigned
+share_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry (e, struct frame, share_elem);
+  return (hash_int (f->inode_sector) ^ hash_int (f->ofs)
+          ^ hash_int (f->read_bytes));
+}
+
+/* Returns true if shared frame A precedes shared frame B. */
+static bool
+share_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED)
+{
+  const struct frame *a = hash_entry (a_, struct frame, share_elem);
+  const struct frame *b = hash_entry (b_, struct frame, share_elem);
+  if (a->inode_sector != b->inode_sector)
+    return a->inode_sector < b->inode_sector;
+  else if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  else
+    return a->read_bytes < b->read_bytes;
+}
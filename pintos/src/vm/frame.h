@@ -0,0 +1,23 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/palloc.h"
+
+struct file;
+
+void frame_init (void);
+void *frame_alloc (enum palloc_flags);
+void frame_free (void *kpage);
+void frame_ref (void *kpage);
+bool frame_is_shared (void *kpage);
+void *frame_zero_page (void);
+bool frame_copy_on_write (uint32_t *pd, void *upage);
+void *frame_get_shared (struct file *, off_t ofs, size_t read_bytes);
+void *frame_find_shared (struct file *, off_t ofs, size_t read_bytes);
+void frame_print_stats (void);
+
+#endif /* vm/frame.h */
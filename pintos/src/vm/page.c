@@ -0,0 +1,719 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   Each process records here, for every page of its address
+   space, where the page's contents come from.  Nothing is loaded
+   when a process starts: the first access to each page faults,
+   and page_handle_fault() reads it in (or, for read-only
+   executable pages, maps a frame another process already read).
+
+   Because every fault costs a full trip through the interrupt
+   machinery, a fault also maps the neighbouring pages in an
+   aligned window of page_fault_around pages, as long as they can
+   be mapped without any disk I/O: zero pages and executable
+   pages already in the frame table's share table.  Sequential
+   scans through arrays and code then take one fault per window
+   instead of one per page.
+
+   Zero pages that are only read are all backed by the frame
+   table's single page of zeros, mapped copy-on-write, so a large
+   array that a program never writes costs no memory.  The first
+   write to such a page gives it a private frame.
+
+   When the user pool runs dry, page_evict() takes a page away
+   from some process.  Clean pages are simply unmapped, to be
+   read in again from their file or zero-filled; modified pages
+   go to swap.  Each process's working set is estimated by
+   sampling the accessed bits of its pages every WS_INTERVAL
+   timer ticks, and the victim is the process holding the most
+   resident pages beyond its working set, so that a process that
+   outgrows memory steals from itself before it steals from
+   others.  A process may also be given a resident set limit,
+   beyond which it can only grow by evicting its own pages. */
+
+/* -fa: Maximum number of pages mapped per page fault, counting
+   the page that faulted.  1 disables fault-around. */
+size_t page_fault_around = 8;
+
+/* -rss: Resident set limit, in pages, given to each process when
+   it is loaded and inherited across fork().  0 means no
+   limit. */
+size_t page_rss_limit = 0;
+
+/* Timer ticks between working set samples of a process. */
+#define WS_INTERVAL TIMER_FREQ
+
+/* Every process's supplemental page table, along with its
+   resident set and working set counts, is protected by
+   page_lock, since eviction reaches into other processes. */
+static struct lock page_lock;
+static struct list page_procs;          /* Processes with page tables. */
+
+/* Statistics. */
+static long long fault_cnt;             /* Faults resolved here. */
+static long long fault_around_cnt;      /* Pages mapped ahead of use. */
+static long long evict_cnt;             /* Pages evicted. */
+static long long evict_limit_cnt;       /* ...to enforce an RSS limit. */
+
+/* Maximum number of exited processes whose own fault counts are
+   kept for page_print_stats().  Processes that exit after that
+   are only counted in the totals. */
+#define PROC_STATS_MAX 32
+
+/* Fault counts of a process that has exited. */
+struct proc_stats
+  {
+    char name[16];                      /* Process name. */
+    tid_t tid;                          /* Process's thread id. */
+    long long fault_cnt;                /* Page faults resolved. */
+    long long fault_around_cnt;         /* Pages mapped by fault-around. */
+  };
+
+/* Exited processes, protected by page_lock. */
+static struct proc_stats proc_stats[PROC_STATS_MAX];
+static size_t proc_stats_cnt;           /* Number in proc_stats. */
+static size_t proc_stats_dropped;       /* Number not kept. */
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destroy;
+static struct page *page_lookup (struct thread *, const void *upage);
+static bool page_insert (struct page *);
+static bool page_in (struct thread *, struct page *, bool write);
+static bool map_zero_page (struct thread *, struct page *);
+static void fault_around (struct thread *, void *upage);
+static void sample_working_set (struct thread *);
+static bool evict_from (struct thread *, bool need_frame);
+static bool evict_page (struct thread *, struct page *, bool need_frame);
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void)
+{
+  lock_init (&page_lock);
+  list_init (&page_procs);
+}
+
+/* Initializes the current process's supplemental page table.
+   Returns true if successful, false if memory allocation
+   fails. */
+bool
+page_table_init (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!hash_init (&t->pages, page_hash, page_less, NULL))
+    return false;
+  t->has_pages = true;
+  t->rss = 0;
+  t->rss_limit = page_rss_limit;
+  t->ws = 0;
+  t->ws_sample = timer_ticks ();
+
+  lock_acquire (&page_lock);
+  list_push_back (&page_procs, &t->page_elem);
+  lock_release (&page_lock);
+  return true;
+}
+
+/* Initializes DST's supplemental page table as a copy of SRC's,
+   for fork(), and copies SRC's user mappings into DST's page
+   directory with pagedir_fork().  Pages backed by SRC's
+   executable are backed by DST's in the copy.  Returns true if
+   successful, false if memory allocation fails, in which case
+   DST must still call page_table_destroy() as it exits. */
+bool
+page_table_copy (struct thread *dst, struct thread *src)
+{
+  struct hash_iterator i;
+  bool success = true;
+
+  if (!hash_init (&dst->pages, page_hash, page_less, NULL))
+    return false;
+  dst->has_pages = true;
+  dst->rss_limit = src->rss_limit;
+  dst->ws_sample = timer_ticks ();
+
+  lock_acquire (&page_lock);
+  list_push_back (&page_procs, &dst->page_elem);
+
+  hash_first (&i, &src->pages);
+  while (hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+      struct page *copy = malloc (sizeof *copy);
+      if (copy == NULL)
+        {
+          success = false;
+          break;
+        }
+      *copy = *p;
+      if (copy->file == src->exec_file)
+        copy->file = dst->exec_file;
+      if (copy->type == PAGE_SWAP)
+        swap_ref (copy->swap_slot);
+      hash_insert (&dst->pages, &copy->hash_elem);
+    }
+
+  if (success && pagedir_fork (dst->pagedir, src->pagedir))
+    {
+      dst->rss = src->rss;
+      dst->ws = src->ws;
+    }
+  else
+    success = false;
+  lock_release (&page_lock);
+
+  return success;
+}
+
+/* Destroys the current process's supplemental page table, if it
+   has one, and releases its swap slots.  The frames it maps are
+   released by pagedir_destroy().  Keeps the process's fault
+   counts for page_print_stats(). */
+void
+page_table_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!t->has_pages)
+    return;
+  t->has_pages = false;
+
+  lock_acquire (&page_lock);
+  list_remove (&t->page_elem);
+  hash_destroy (&t->pages, page_destroy);
+  if (proc_stats_cnt < PROC_STATS_MAX)
+    {
+      struct proc_stats *ps = &proc_stats[proc_stats_cnt++];
+      strlcpy (ps->name, t->name, sizeof ps->name);
+      ps->tid = t->tid;
+      ps->fault_cnt = t->fault_cnt;
+      ps->fault_around_cnt = t->fault_around_cnt;
+    }
+  else
+    proc_stats_dropped++;
+  lock_release (&page_lock);
+}
+
+/* Adds UPAGE to the current process's address space, to be
+   filled on first access with READ_BYTES bytes from FILE
+   starting at offset OFS followed by zeros.  Returns true if
+   successful, false if UPAGE is already in use or memory
+   allocation fails. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->writable = writable;
+  p->type = PAGE_FILE;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  return page_insert (p);
+}
+
+/* Adds UPAGE to the current process's address space as a page
+   of zeros.  Returns true if successful, false if UPAGE is
+   already in use or memory allocation fails. */
+bool
+page_add_zero (void *upage, bool writable)
+{
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->writable = writable;
+  p->type = PAGE_ZERO;
+  p->file = NULL;
+  p->ofs = 0;
+  p->read_bytes = 0;
+  return page_insert (p);
+}
+
+/* Maps UPAGE, which must have been added to the current
+   process's address space, into memory ahead of any access, for
+   the caller to fill in.  From then on the page's contents are
+   kept in memory or in swap.  Returns true if successful, false
+   on failure. */
+bool
+page_load (void *upage)
+{
+  struct thread *t = thread_current ();
+  struct page *p;
+  bool success = false;
+
+  lock_acquire (&page_lock);
+  p = page_lookup (t, upage);
+  if (p != NULL
+      && (pagedir_get_page (t->pagedir, upage) != NULL
+          || page_in (t, p, true)))
+    {
+      p->type = PAGE_ANON;
+      success = true;
+    }
+  lock_release (&page_lock);
+  return success;
+}
+
+/* Handles a page fault at FAULT_ADDR in the current process.
+   NOT_PRESENT and WRITE describe the fault as in page_fault().
+   Brings in a page that is not in memory, along with its
+   available neighbours, or gives the process its own copy of a
+   copy-on-write page.  Returns true if the faulting access can
+   be retried, false if it was invalid. */
+bool
+page_handle_fault (void *fault_addr, bool not_present, bool write)
+{
+  struct thread *t = thread_current ();
+  void *upage = pg_round_down (fault_addr);
+  struct page *p;
+  bool success = false;
+
+  if (!is_user_vaddr (fault_addr) || t->pagedir == NULL)
+    return false;
+
+  lock_acquire (&page_lock);
+  p = page_lookup (t, upage);
+  if (p == NULL)
+    {
+      lock_release (&page_lock);
+      return false;
+    }
+
+  /* Any memory allocated below may come from evicting a page, but
+     never this one. */
+  p->pinned = true;
+  if (!not_present)
+    {
+      /* A write to a present page.  Only valid if the page is
+         copy-on-write. */
+      success = write && frame_copy_on_write (t->pagedir, upage);
+    }
+  else if (!write || p->writable)
+    {
+      sample_working_set (t);
+      while (t->rss_limit != 0 && t->rss >= t->rss_limit
+             && evict_from (t, false))
+        evict_limit_cnt++;
+
+      success = page_in (t, p, write);
+      if (success)
+        {
+          t->fault_cnt++;
+          fault_cnt++;
+          if (page_fault_around > 1)
+            fault_around (t, upage);
+        }
+    }
+  p->pinned = false;
+  lock_release (&page_lock);
+
+  return success;
+}
+
+/* Evicts a user page from some process to free a frame.  Called
+   by frame_alloc() when the user pool is exhausted.  Takes the
+   page from the process furthest over its estimated working set,
+   or, if none is over, from the process with the most resident
+   pages.  Returns true if a frame was freed, false if no page
+   could be evicted.
+
+   Only the page fault path allocates frames with page_lock held;
+   other callers get false, since eviction requires the lock. */
+bool
+page_evict (void)
+{
+  struct thread *victim = NULL;
+  size_t victim_excess = 0;
+  struct list_elem *e;
+
+  if (!lock_held_by_current_thread (&page_lock))
+    return false;
+
+  for (e = list_begin (&page_procs); e != list_end (&page_procs);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, page_elem);
+      size_t excess;
+
+      sample_working_set (t);
+      excess = t->rss > t->ws ? t->rss - t->ws : 0;
+      if (victim == NULL || excess > victim_excess
+          || (excess == victim_excess && t->rss > victim->rss))
+        {
+          victim = t;
+          victim_excess = excess;
+        }
+    }
+  if (victim == NULL)
+    return false;
+  if (evict_from (victim, true))
+    return true;
+
+  /* The victim had nothing we could take.  Try everyone else. */
+  for (e = list_begin (&page_procs); e != list_end (&page_procs);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, page_elem);
+      if (t != victim && evict_from (t, true))
+        return true;
+    }
+  return false;
+}
+
+/* Prints supplemental page table statistics, in total and for
+   each process, whether it has exited or is still running. */
+void
+page_print_stats (void)
+{
+  struct list_elem *e;
+  size_t i;
+
+  printf ("Paging: %lld faults resolved, %lld pages mapped by fault-around\n",
+          fault_cnt, fault_around_cnt);
+  for (i = 0; i < proc_stats_cnt; i++)
+    {
+      struct proc_stats *ps = &proc_stats[i];
+      printf ("Paging: %s (tid %d): %lld faults, %lld pages mapped ahead\n",
+              ps->name, ps->tid, ps->fault_cnt, ps->fault_around_cnt);
+    }
+  if (proc_stats_dropped > 0)
+    printf ("Paging: %zu more processes exited\n", proc_stats_dropped);
+  for (e = list_begin (&page_procs); e != list_end (&page_procs);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, page_elem);
+      printf ("Paging: %s (tid %d, running): %lld faults, "
+              "%lld pages mapped ahead\n",
+              t->name, t->tid, t->fault_cnt, t->fault_around_cnt);
+    }
+  printf ("Paging: %lld pages evicted, %lld to enforce resident set limits\n",
+          evict_cnt, evict_limit_cnt);
+  swap_print_stats ();
+}
+
+/* Adds P to the current process's supplemental page table.
+   Returns true if successful, false (freeing P) if its page is
+   already in use. */
+static bool
+page_insert (struct page *p)
+{
+  bool success;
+
+  p->pinned = false;
+  p->swap_slot = SWAP_ERROR;
+
+  lock_acquire (&page_lock);
+  success = hash_insert (&thread_current ()->pages, &p->hash_elem) == NULL;
+  lock_release (&page_lock);
+
+  if (!success)
+    free (p);
+  return success;
+}
+
+/* Brings page P into a frame and maps it into T's address space.
+   WRITE is true if the page is about to be written, in which case
+   a zero page gets a private frame right away.  Returns true if
+   successful, false if memory is exhausted or the file cannot be
+   read. */
+static bool
+page_in (struct thread *t, struct page *p, bool write)
+{
+  void *kpage;
+
+  ASSERT (lock_held_by_current_thread (&page_lock));
+  ASSERT (p->type != PAGE_ANON);
+
+  if (p->type == PAGE_ZERO && !write)
+    return map_zero_page (t, p);
+  else if (p->type == PAGE_FILE && !p->writable)
+    kpage = frame_get_shared (p->file, p->ofs, p->read_bytes);
+  else if (p->type == PAGE_FILE)
+    {
+      kpage = frame_alloc (0);
+      if (kpage == NULL)
+        return false;
+      if (file_read_at (p->file, kpage, p->read_bytes, p->ofs)
+          != (off_t) p->read_bytes)
+        {
+          frame_free (kpage);
+          return false;
+        }
+      memset ((uint8_t *) kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+  else if (p->type == PAGE_SWAP)
+    {
+      kpage = frame_alloc (0);
+      if (kpage != NULL)
+        swap_read (p->swap_slot, kpage);
+    }
+  else
+    kpage = frame_alloc (PAL_ZERO);
+  if (kpage == NULL)
+    return false;
+
+  if (!pagedir_set_page (t->pagedir, p->upage, kpage, p->writable))
+    {
+      frame_free (kpage);
+      return false;
+    }
+  if (p->type == PAGE_SWAP)
+    {
+      /* The frame is now the only copy. */
+      swap_free (p->swap_slot);
+      p->swap_slot = SWAP_ERROR;
+      p->type = PAGE_ANON;
+    }
+  t->rss++;
+  return true;
+}
+
+/* Maps page P, which must be a zero page, to the shared page of
+   zeros in T's address space, copy-on-write if P is writable.
+   Returns true if successful, false if memory is exhausted. */
+static bool
+map_zero_page (struct thread *t, struct page *p)
+{
+  void *kpage = frame_zero_page ();
+
+  if (!pagedir_set_page (t->pagedir, p->upage, kpage, false))
+    {
+      frame_free (kpage);
+      return false;
+    }
+  if (p->writable)
+    pagedir_set_cow (t->pagedir, p->upage);
+  t->rss++;
+  return true;
+}
+
+/* Maps the pages around UPAGE, within an aligned window of
+   page_fault_around pages, that are in T's address space but not
+   yet in memory and can be brought in without disk I/O.  Stops
+   at T's resident set limit. */
+static void
+fault_around (struct thread *t, void *upage)
+{
+  uint8_t *start = pg_round_down (upage);
+  uint8_t *end, *addr;
+
+  start -= (pg_no (upage) % page_fault_around) * PGSIZE;
+  end = start + page_fault_around * PGSIZE;
+  for (addr = start; addr < end && is_user_vaddr (addr); addr += PGSIZE)
+    {
+      struct page *p;
+      void *kpage;
+
+      if (t->rss_limit != 0 && t->rss >= t->rss_limit)
+        break;
+      if (addr == upage || pagedir_get_page (t->pagedir, addr) != NULL)
+        continue;
+      p = page_lookup (t, addr);
+      if (p == NULL)
+        continue;
+
+      if (p->type == PAGE_ZERO)
+        {
+          if (!map_zero_page (t, p))
+            break;
+        }
+      else
+        {
+          kpage = (p->type == PAGE_FILE && !p->writable
+                   ? frame_find_shared (p->file, p->ofs, p->read_bytes)
+                   : NULL);
+          if (kpage == NULL)
+            continue;
+          if (!pagedir_set_page (t->pagedir, addr, kpage, false))
+            {
+              frame_free (kpage);
+              break;
+            }
+          t->rss++;
+        }
+      t->fault_around_cnt++;
+      fault_around_cnt++;
+    }
+}
+
+/* Re-estimates T's working set as the number of its resident
+   pages accessed since the last sample, if WS_INTERVAL ticks
+   have passed since then, and clears the accessed bits for the
+   next interval. */
+static void
+sample_working_set (struct thread *t)
+{
+  struct hash_iterator i;
+  size_t ws = 0;
+
+  ASSERT (lock_held_by_current_thread (&page_lock));
+
+  if (timer_elapsed (t->ws_sample) < WS_INTERVAL)
+    return;
+
+  hash_first (&i, &t->pages);
+  while (hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+      if (pagedir_get_page (t->pagedir, p->upage) != NULL
+          && pagedir_is_accessed (t->pagedir, p->upage))
+        {
+          pagedir_set_accessed (t->pagedir, p->upage, false);
+          ws++;
+        }
+    }
+  t->ws = ws;
+  t->ws_sample = timer_ticks ();
+}
+
+/* Evicts one of T's resident pages, preferring one that has not
+   been accessed recently: a first pass over T's pages gives each
+   recently accessed page a second chance by clearing its
+   accessed bit.  If NEED_FRAME is true, only pages whose frames
+   would be freed are considered.  Returns true if a page was
+   evicted. */
+static bool
+evict_from (struct thread *t, bool need_frame)
+{
+  int pass;
+
+  for (pass = 0; pass < 2; pass++)
+    {
+      struct hash_iterator i;
+
+      hash_first (&i, &t->pages);
+      while (hash_next (&i))
+        {
+          struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+
+          if (p->pinned || pagedir_get_page (t->pagedir, p->upage) == NULL)
+            continue;
+          if (pass == 0 && pagedir_is_accessed (t->pagedir, p->upage))
+            {
+              pagedir_set_accessed (t->pagedir, p->upage, false);
+              continue;
+            }
+          if (evict_page (t, p, need_frame))
+            return true;
+        }
+    }
+  return false;
+}
+
+/* Unmaps resident page P from T's address space, writing it to
+   swap first if it may differ from its original contents.
+   Returns true if successful, false if P's frame is shared and
+   NEED_FRAME is true or if P must be written to swap and swap is
+   full. */
+static bool
+evict_page (struct thread *t, struct page *p, bool need_frame)
+{
+  void *kpage = pagedir_get_page (t->pagedir, p->upage);
+  size_t slot = SWAP_ERROR;
+  enum intr_level old_level;
+  bool dirty;
+
+  if (need_frame && frame_is_shared (kpage))
+    return false;
+
+  /* Reserve a slot up front for any page that could have been
+     modified, so that we never unmap a page we cannot save. */
+  if (p->type == PAGE_ANON || p->writable)
+    slot = swap_alloc ();
+
+  /* T might run, and write the page, if we are preempted between
+     checking the dirty bit and unmapping. */
+  old_level = intr_disable ();
+  dirty = p->type == PAGE_ANON || pagedir_is_dirty (t->pagedir, p->upage);
+  if (!dirty || slot != SWAP_ERROR)
+    pagedir_clear_page (t->pagedir, p->upage);
+  intr_set_level (old_level);
+
+  if (dirty)
+    {
+      if (slot == SWAP_ERROR)
+        return false;
+      swap_write (slot, kpage);
+      p->type = PAGE_SWAP;
+      p->swap_slot = slot;
+    }
+  else if (slot != SWAP_ERROR)
+    swap_free (slot);
+
+  frame_free (kpage);
+  t->rss--;
+  evict_cnt++;
+  return true;
+}
+
+/* Returns the page containing UPAGE in T's supplemental page
+   table, or a null pointer if there is none. */
+static struct page *
+page_lookup (struct thread *t, const void *upage)
+{
+  struct page key;
+  struct hash_elem *e;
+
+  key.upage = pg_round_down (upage);
+  e = hash_find (&t->pages, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/* Frees page E and its swap slot, if any.  Used by
+   page_table_destroy(). */
+static void
+page_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+  if (p->type == PAGE_SWAP)
+    swap_free (p->swap_slot);
+  free (p);
+}
+
+/* Returns a hash value for page E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED)
+{
+  const struct page *a = hash_entry (a_, struct page, hash_elem);
+  const struct page *b = hash_entry (b_, struct page, hash_elem);
+  return a->upage < b->upage;
+}
@@ -0,0 +1,60 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct thread;
+
+/* Where a page's initial contents come from. */
+enum page_type
+  {
+    PAGE_FILE,                  /* Read from a file, then zero-filled. */
+    PAGE_ZERO,                  /* All zeros. */
+    PAGE_ANON,                  /* Only in memory; swapped if evicted. */
+    PAGE_SWAP                   /* In a swap slot. */
+  };
+
+/* A page of user virtual memory, in a process's supplemental
+   page table. */
+struct page
+  {
+    struct hash_elem hash_elem;         /* Element in thread's `pages'. */
+    void *upage;                        /* User virtual address. */
+    bool writable;                      /* May the process write it? */
+    enum page_type type;                /* Where the contents are. */
+    bool pinned;                        /* Being faulted in; keep mapped. */
+
+    /* PAGE_FILE only. */
+    struct file *file;                  /* File to read. */
+    off_t ofs;                          /* Offset in FILE. */
+    size_t read_bytes;                  /* Bytes to read; rest is zeroed. */
+
+    /* PAGE_SWAP only. */
+    size_t swap_slot;                   /* Slot holding the contents. */
+  };
+
+/* -fa: Maximum number of pages mapped per page fault. */
+extern size_t page_fault_around;
+
+/* -rss: Resident set limit given to each new process. */
+extern size_t page_rss_limit;
+
+void page_init (void);
+bool page_table_init (void);
+bool page_table_copy (struct thread *dst, struct thread *src);
+void page_table_destroy (void);
+
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    size_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_load (void *upage);
+bool page_handle_fault (void *fault_addr, bool not_present, bool write);
+bool page_evict (void);
+
+void page_print_stats (void);
+
+#endif /* vm/page.h */
@@ -0,0 +1,247 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <list.h>
+#include <lz.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap space.
+
+   The swap device is divided into page-sized slots.  A slot holds
+   the contents of one evicted page until it is read back in.
+   fork() can leave the same slot named by the supplemental page
+   tables of several processes, so each slot has a reference
+   count and is released when the last reference is dropped.
+
+   Writing a page to disk takes 8 sector transfers, but many
+   evicted pages are mostly zeros or otherwise repetitive.  So a
+   page is first compressed, and if it shrinks enough it is kept
+   in memory instead, still under its slot number; swap_read()
+   then costs only a decompression.  The compressed pages are
+   capped at swap_zcache_pages pages of memory in total; beyond
+   that, the oldest are written back to their slots on disk. */
+
+/* Sectors per slot. */
+#define SLOT_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Pages that do not compress to this size or smaller go straight
+   to disk. */
+#define ZPAGE_MAX (PGSIZE / 2)
+
+/* A compressed page kept in memory. */
+struct zpage
+  {
+    struct list_elem elem;              /* Element in zpage_list. */
+    size_t slot;                        /* Swap slot. */
+    size_t size;                        /* Bytes in DATA. */
+    uint8_t data[];                     /* Compressed contents. */
+  };
+
+/* -zswap: Pages of memory that compressed pages may use. */
+size_t swap_zcache_pages = 64;
+
+static struct block *swap_device;       /* Swap device, if any. */
+static struct bitmap *swap_map;         /* Slots in use. */
+static uint16_t *swap_refs;             /* Reference count per slot. */
+static struct zpage **swap_zpages;      /* Compressed copy per slot. */
+static struct list zpage_list;          /* Compressed pages, oldest first. */
+static size_t zpage_bytes;              /* Total size of compressed pages. */
+static void *zbuf;                      /* Compression output. */
+static void *zwork;                     /* Compression scratch memory. */
+static struct lock swap_lock;           /* Protects all of the above. */
+
+/* Statistics. */
+static long long write_cnt;             /* Pages written to disk. */
+static long long read_cnt;              /* Pages read from disk. */
+static long long zstore_cnt;            /* Pages compressed in memory. */
+static long long zload_cnt;             /* ...read back from memory. */
+static long long zwriteback_cnt;        /* ...written back to disk. */
+
+static void disk_write (size_t slot, const void *kpage);
+static void zpage_writeback (struct zpage *);
+static void zpage_free (struct zpage *);
+
+/* Initializes swap space.  Swap is left empty if there is no
+   swap device, so that every swap_alloc() fails. */
+void
+swap_init (void)
+{
+  size_t slot_cnt = 0;
+
+  lock_init (&swap_lock);
+  list_init (&zpage_list);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / SLOT_SECTORS;
+
+  swap_map = bitmap_create (slot_cnt);
+  swap_refs = calloc (slot_cnt, sizeof *swap_refs);
+  swap_zpages = calloc (slot_cnt, sizeof *swap_zpages);
+  zbuf = palloc_get_page (PAL_ASSERT);
+  zwork = malloc (LZ_WORK_SIZE);
+  if (swap_map == NULL || zwork == NULL
+      || (slot_cnt > 0 && (swap_refs == NULL || swap_zpages == NULL)))
+    PANIC ("swap table allocation failed");
+}
+
+/* Reserves a free swap slot with one reference and returns its
+   number, or SWAP_ERROR if swap is full. */
+size_t
+swap_alloc (void)
+{
+  size_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip_next (swap_map, 1, false);
+  if (slot != BITMAP_ERROR)
+    swap_refs[slot] = 1;
+  lock_release (&swap_lock);
+  return slot != BITMAP_ERROR ? slot : SWAP_ERROR;
+}
+
+/* Writes the page at KPAGE to swap slot SLOT, keeping it in
+   memory compressed if it compresses well. */
+void
+swap_write (size_t slot, const void *kpage)
+{
+  struct zpage *z = NULL;
+  size_t size;
+
+  ASSERT (bitmap_test (swap_map, slot));
+  ASSERT (swap_zpages[slot] == NULL);
+
+  lock_acquire (&swap_lock);
+  if (swap_zcache_pages > 0)
+    {
+      size = lz_compress (kpage, PGSIZE, zbuf, ZPAGE_MAX, zwork);
+      if (size > 0)
+        z = malloc (sizeof *z + size);
+    }
+  if (z == NULL)
+    {
+      disk_write (slot, kpage);
+      lock_release (&swap_lock);
+      return;
+    }
+
+  z->slot = slot;
+  z->size = size;
+  memcpy (z->data, zbuf, size);
+  swap_zpages[slot] = z;
+  list_push_back (&zpage_list, &z->elem);
+  zpage_bytes += size;
+  zstore_cnt++;
+
+  /* Make room by writing the oldest compressed pages to disk. */
+  while (zpage_bytes > swap_zcache_pages * PGSIZE)
+    zpage_writeback (list_entry (list_front (&zpage_list),
+                                 struct zpage, elem));
+  lock_release (&swap_lock);
+}
+
+/* Reads swap slot SLOT into the page at KPAGE.  The slot keeps
+   its reference; release it with swap_free(). */
+void
+swap_read (size_t slot, void *kpage)
+{
+  struct zpage *z;
+
+  ASSERT (bitmap_test (swap_map, slot));
+
+  lock_acquire (&swap_lock);
+  z = swap_zpages[slot];
+  if (z != NULL)
+    {
+      if (lz_decompress (z->data, z->size, kpage, PGSIZE) != PGSIZE)
+        PANIC ("corrupt compressed swap page");
+      zload_cnt++;
+    }
+  else
+    {
+      block_read_multiple (swap_device, slot * SLOT_SECTORS, SLOT_SECTORS,
+                           kpage);
+      read_cnt++;
+    }
+  lock_release (&swap_lock);
+}
+
+/* Adds a reference to swap slot SLOT. */
+void
+swap_ref (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (swap_refs[slot] > 0 && swap_refs[slot] < UINT16_MAX);
+  swap_refs[slot]++;
+  lock_release (&swap_lock);
+}
+
+/* Drops a reference to swap slot SLOT, freeing the slot when the
+   last one goes away. */
+void
+swap_free (size_t slot)
+{
+  lock_acquire (&swap_lock);
+  ASSERT (swap_refs[slot] > 0);
+  if (--swap_refs[slot] == 0)
+    {
+      if (swap_zpages[slot] != NULL)
+        zpage_free (swap_zpages[slot]);
+      bitmap_reset (swap_map, slot);
+    }
+  lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+  printf ("Swap: %lld pages written, %lld read\n", write_cnt, read_cnt);
+  printf ("Swap: %lld pages compressed in memory, %lld read back, "
+          "%lld written back\n", zstore_cnt, zload_cnt, zwriteback_cnt);
+}
+
+/* Writes the page at KPAGE to SLOT on the swap device.  The swap
+   lock must be held. */
+static void
+disk_write (size_t slot, const void *kpage)
+{
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+
+  block_write_multiple (swap_device, slot * SLOT_SECTORS, SLOT_SECTORS,
+                        kpage);
+  write_cnt++;
+}
+
+/* Moves compressed page Z to its slot on disk.  The swap lock
+   must be held. */
+static void
+zpage_writeback (struct zpage *z)
+{
+  size_t slot = z->slot;
+
+  /* ZBUF is free again: the page that used it was just copied
+     out to its own zpage. */
+  if (lz_decompress (z->data, z->size, zbuf, PGSIZE) != PGSIZE)
+    PANIC ("corrupt compressed swap page");
+  zpage_free (z);
+  disk_write (slot, zbuf);
+  zwriteback_cnt++;
+}
+
+/* Frees compressed page Z.  The swap lock must be held. */
+static void
+zpage_free (struct zpage *z)
+{
+  ASSERT (lock_held_by_current_thread (&swap_lock));
+
+  list_remove (&z->elem);
+  swap_zpages[z->slot] = NULL;
+  zpage_bytes -= z->size;
+  free (z);
+}
@@ -0,0 +1,21 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returned by swap_alloc() when swap is full or absent. */
+#define SWAP_ERROR SIZE_MAX
+
+/* -zswap: Pages of memory that compressed swap pages may use. */
+extern size_t swap_zcache_pages;
+
+void swap_init (void);
+size_t swap_alloc (void);
+void swap_write (size_t slot, const void *kpage);
+void swap_read (size_t slot, void *kpage);
+void swap_ref (size_t slot);
+void swap_free (size_t slot);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */